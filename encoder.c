@@ -0,0 +1,459 @@
+#include <time.h>
+#include <zlib.h>
+#include "raytracer.h"
+#include "encoder.h"
+
+static double now(){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+//Return 0 or ERROR_WRITING
+static int writeBytes(FILE* file, char* filename, const void* bytes, size_t size){
+  if(fwrite(bytes, 1, size, file) != size){
+    fprintf(stderr, "Error: Could not write data in file \"%s\"\n", filename);
+    return ERROR_WRITING;
+  }
+  return 0;
+}
+
+static void writeInt(unsigned char* out, unsigned int value){
+  out[0] = value >> 24;
+  out[1] = value >> 16;
+  out[2] = value >> 8;
+  out[3] = value;
+}
+
+//Write the data in a P6 ppm file, return 0 or ERROR_WRITING
+int createScene(char* ppm, unsigned char* data, int width, int height){
+  FILE* outputFile = fopen(ppm, "w");
+
+  if (outputFile == NULL) {
+    fprintf(stderr, "Error: Could not open file \"%s\"\n", ppm);
+    return ERROR_WRITING;
+  }
+
+  if(fprintf(outputFile, "P6\n#Written by raycaster program made by Bruno TESSIER\n%d %d\n255\n", width, height) < 63){
+    fprintf(stderr, "Error: Could not write header in file \"%s\"\n", ppm);
+    fclose(outputFile);
+    return ERROR_WRITING;
+  }
+  int error = writeBytes(outputFile, ppm, data, (size_t)width * height * 3);
+  fclose(outputFile);
+  return error;
+}
+
+//Write 3 float channels in a little endian PFM file, data rows are stored from top to bottom
+//Return 0 or ERROR_WRITING
+int createPfm(char* pfm, float* data, int width, int height){
+  FILE* outputFile = fopen(pfm, "wb");
+  int y;
+  int error = 0;
+
+  if (outputFile == NULL) {
+    fprintf(stderr, "Error: Could not open file \"%s\"\n", pfm);
+    return ERROR_WRITING;
+  }
+  fprintf(outputFile, "PF\n%d %d\n-1.0\n", width, height);
+  for(y = height - 1; y >= 0 && !error; y--){ //PFM rows go from bottom to top
+    error = writeBytes(outputFile, pfm, data + 3 * (size_t)width * y, 3 * (size_t)width * sizeof(float));
+  }
+  fclose(outputFile);
+  return error;
+}
+
+//Choose the output format from the extension of the file
+int imageFormat(char* filename){
+  char* dot = strrchr(filename, '.');
+  if(dot != NULL && strcasecmp(dot, ".qoi") == 0){
+    return FORMAT_QOI;
+  }
+  if(dot != NULL && strcasecmp(dot, ".png") == 0){
+    return FORMAT_PNG;
+  }
+  return FORMAT_PPM;
+}
+
+//Encode the image rows [encoder->qoiRow, row1[ in the QOI stream, rows must come from top to bottom
+static void encodeQoiRows(encoders encoder, int row1){
+  size_t pixels = (size_t)encoder->width * encoder->height;
+  size_t i = (size_t)encoder->width * encoder->qoiRow;
+  size_t end = (size_t)encoder->width * row1;
+  unsigned char* out = encoder->qoi;
+  unsigned char* previous = encoder->qoiPrevious;
+  size_t p = encoder->qoiSize;
+  int run = encoder->qoiRun;
+
+  for(; i < end; i++){
+    unsigned char pixel[4] = {encoder->data[3 * i], encoder->data[3 * i + 1], encoder->data[3 * i + 2], 255};
+    if(memcmp(pixel, previous, 4) == 0){
+      run++;
+      if(run == 62 || i == pixels - 1){
+        out[p++] = 0xc0 | (run - 1); //QOI_OP_RUN
+        run = 0;
+      }
+      continue;
+    }
+    if(run > 0){
+      out[p++] = 0xc0 | (run - 1);
+      run = 0;
+    }
+
+    int hash = (pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) % 64;
+    if(memcmp(encoder->qoiIndex[hash], pixel, 4) == 0){
+      out[p++] = hash; //QOI_OP_INDEX
+    }
+    else{
+      memcpy(encoder->qoiIndex[hash], pixel, 4);
+      signed char dr = pixel[0] - previous[0];
+      signed char dg = pixel[1] - previous[1];
+      signed char db = pixel[2] - previous[2];
+      signed char drg = dr - dg;
+      signed char dbg = db - dg;
+      if(dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1){
+        out[p++] = 0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2); //QOI_OP_DIFF
+      }
+      else if(dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7){
+        out[p++] = 0x80 | (dg + 32); //QOI_OP_LUMA
+        out[p++] = (drg + 8) << 4 | (dbg + 8);
+      }
+      else{
+        out[p++] = 0xfe; //QOI_OP_RGB
+        out[p++] = pixel[0];
+        out[p++] = pixel[1];
+        out[p++] = pixel[2];
+      }
+    }
+    memcpy(previous, pixel, 4);
+  }
+  encoder->qoiSize = p;
+  encoder->qoiRun = run;
+  encoder->qoiRow = row1;
+}
+
+//Write the end of the QOI stream in the file, set bytes to the number of bytes written
+//Return 0 or ERROR_WRITING
+static int writeQoi(encoders encoder, size_t* bytes){
+  encodeQoiRows(encoder, encoder->height);
+  unsigned char* out = encoder->qoi;
+  size_t p = encoder->qoiSize;
+  memset(out + p, 0, 7);
+  out[p + 7] = 1;
+  p += 8;
+
+  *bytes = p;
+  FILE* outputFile = fopen(encoder->filename, "wb");
+  if (outputFile == NULL) {
+    fprintf(stderr, "Error: Could not open file \"%s\"\n", encoder->filename);
+    return ERROR_WRITING;
+  }
+  int error = writeBytes(outputFile, encoder->filename, out, p);
+  fclose(outputFile);
+  return error;
+}
+
+//Filter (Sub) and deflate one band, every band but the last one ends on a sync flush so they can be concatenated
+static void compressBand(encoders encoder, int band){
+  int row0 = band * encoder->bandHeight;
+  int row1 = (row0 + encoder->bandHeight < encoder->height) ? row0 + encoder->bandHeight : encoder->height;
+  size_t rowSize = 1 + 3 * (size_t)encoder->width;
+  size_t size = rowSize * (row1 - row0);
+  unsigned char* filtered = malloc(size);
+  int y;
+  size_t x;
+
+  for(y = row0; y < row1; y++){
+    unsigned char* row = encoder->data + 3 * (size_t)encoder->width * y;
+    unsigned char* out = filtered + rowSize * (y - row0);
+    out[0] = 1; //Sub filter, only needs the current row
+    for(x = 0; x < 3; x++){
+      out[1 + x] = row[x];
+    }
+    for(x = 3; x < 3 * (size_t)encoder->width; x++){
+      out[1 + x] = row[x] - row[x - 3];
+    }
+  }
+
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  deflateInit2(&stream, PNG_LEVEL, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+  size_t bound = deflateBound(&stream, size) + 16;
+  unsigned char* compressed = malloc(bound);
+  stream.next_in = filtered;
+  stream.avail_in = size;
+  stream.next_out = compressed;
+  stream.avail_out = bound;
+  deflate(&stream, (band == encoder->bandCount - 1) ? Z_FINISH : Z_SYNC_FLUSH);
+  encoder->bandSizes[band] = bound - stream.avail_out;
+  deflateEnd(&stream);
+
+  encoder->bandAdlers[band] = adler32(1, filtered, size);
+  encoder->bands[band] = compressed;
+  free(filtered);
+}
+
+//Compress the bands of the queue until the image is complete
+static void* encoderWorker(void* arg){
+  encoders encoder = (encoders)arg;
+  while(1){
+    pthread_mutex_lock(&encoder->mutex);
+    while(encoder->queueStart == encoder->queueEnd && !encoder->finished){
+      pthread_cond_wait(&encoder->ready, &encoder->mutex);
+    }
+    if(encoder->queueStart == encoder->queueEnd){
+      pthread_mutex_unlock(&encoder->mutex);
+      return NULL;
+    }
+    int band = encoder->queue[encoder->queueStart++];
+    pthread_mutex_unlock(&encoder->mutex);
+
+    double start = now();
+    compressBand(encoder, band);
+    double time = now() - start;
+
+    pthread_mutex_lock(&encoder->mutex);
+    encoder->encodeTime += time;
+    pthread_mutex_unlock(&encoder->mutex);
+  }
+}
+
+//Write the PNG chunks around the compressed bands, set bytes to the number of bytes written
+//Return 0 or ERROR_WRITING
+static int writePng(encoders encoder, size_t* bytes){
+  FILE* outputFile = fopen(encoder->filename, "wb");
+  if (outputFile == NULL) {
+    fprintf(stderr, "Error: Could not open file \"%s\"\n", encoder->filename);
+    return ERROR_WRITING;
+  }
+  unsigned char buffer[32];
+  int error = 0;
+  unsigned long adler = 1;
+  size_t total = 0;
+  int band;
+
+  error = error || writeBytes(outputFile, encoder->filename, "\x89PNG\r\n\x1a\n", 8);
+  *bytes = 8;
+
+  writeInt(buffer, 13);
+  memcpy(buffer + 4, "IHDR", 4);
+  writeInt(buffer + 8, encoder->width);
+  writeInt(buffer + 12, encoder->height);
+  buffer[16] = 8; //Bit depth
+  buffer[17] = 2; //RGB
+  buffer[18] = 0;
+  buffer[19] = 0;
+  buffer[20] = 0;
+  writeInt(buffer + 21, crc32(0, buffer + 4, 17));
+  error = error || writeBytes(outputFile, encoder->filename, buffer, 25);
+  *bytes += 25;
+
+  //One IDAT chunk per band, the zlib header goes in the first one and the checksum in the last one
+  for(band = 0; band < encoder->bandCount; band++){
+    size_t rowSize = 1 + 3 * (size_t)encoder->width;
+    int rows = (band == encoder->bandCount - 1) ? encoder->height - band * encoder->bandHeight : encoder->bandHeight;
+    adler = adler32_combine(adler, encoder->bandAdlers[band], rowSize * rows);
+    total += rowSize * rows;
+
+    size_t length = encoder->bandSizes[band] + (band == 0 ? 2 : 0) + (band == encoder->bandCount - 1 ? 4 : 0);
+    writeInt(buffer, length);
+    memcpy(buffer + 4, "IDAT", 4);
+    error = error || writeBytes(outputFile, encoder->filename, buffer, 8);
+    unsigned long crc = crc32(0, buffer + 4, 4);
+    if(band == 0){
+      buffer[0] = 0x78;
+      buffer[1] = 0x9c;
+      error = error || writeBytes(outputFile, encoder->filename, buffer, 2);
+      crc = crc32(crc, buffer, 2);
+    }
+    error = error || writeBytes(outputFile, encoder->filename, encoder->bands[band], encoder->bandSizes[band]);
+    crc = crc32(crc, encoder->bands[band], encoder->bandSizes[band]);
+    if(band == encoder->bandCount - 1){
+      writeInt(buffer, adler);
+      error = error || writeBytes(outputFile, encoder->filename, buffer, 4);
+      crc = crc32(crc, buffer, 4);
+    }
+    writeInt(buffer, crc);
+    error = error || writeBytes(outputFile, encoder->filename, buffer, 4);
+    *bytes += 12 + length;
+  }
+
+  writeInt(buffer, 0);
+  memcpy(buffer + 4, "IEND", 4);
+  writeInt(buffer + 8, crc32(0, buffer + 4, 4));
+  error = error || writeBytes(outputFile, encoder->filename, buffer, 12);
+  *bytes += 12;
+
+  fclose(outputFile);
+  return error ? ERROR_WRITING : 0;
+}
+
+//Let the PNG workers compress the queued bands and wait for them
+static void stopWorkers(encoders encoder){
+  int i;
+  pthread_mutex_lock(&encoder->mutex);
+  encoder->finished = 1;
+  pthread_cond_broadcast(&encoder->ready);
+  pthread_mutex_unlock(&encoder->mutex);
+  for(i = 0; i < encoder->workerCount; i++){
+    pthread_join(encoder->workers[i], NULL);
+  }
+}
+
+static void freePng(encoders encoder){
+  int i;
+  for(i = 0; i < encoder->bandCount; i++){
+    free(encoder->bands[i]);
+  }
+  free(encoder->rowsLeft);
+  free(encoder->bands);
+  free(encoder->bandSizes);
+  free(encoder->bandAdlers);
+  free(encoder->queue);
+  free(encoder->workers);
+  pthread_mutex_destroy(&encoder->mutex);
+  pthread_cond_destroy(&encoder->ready);
+}
+
+//Prepare the output image, threads PNG workers (at least 1) start waiting for rendered bands, NULL on error
+encoders startEncoder(char* filename, unsigned char* data, int width, int height, int bandHeight, int threads){
+  encoders encoder = (encoders)calloc(1, sizeof(*encoder));
+  encoder->filename = filename;
+  encoder->format = imageFormat(filename);
+  encoder->data = data;
+  encoder->width = width;
+  encoder->height = height;
+  encoder->bandHeight = bandHeight;
+  encoder->bandCount = (height + bandHeight - 1) / bandHeight;
+
+  if(encoder->format == FORMAT_PNG){
+    int band;
+    encoder->rowsLeft = malloc(encoder->bandCount * sizeof(int));
+    encoder->bands = calloc(encoder->bandCount, sizeof(unsigned char*));
+    encoder->bandSizes = calloc(encoder->bandCount, sizeof(size_t));
+    encoder->bandAdlers = calloc(encoder->bandCount, sizeof(unsigned long));
+    encoder->queue = malloc(encoder->bandCount * sizeof(int));
+    for(band = 0; band < encoder->bandCount; band++){
+      encoder->rowsLeft[band] = (band == encoder->bandCount - 1) ? height - band * bandHeight : bandHeight;
+    }
+    pthread_mutex_init(&encoder->mutex, NULL);
+    pthread_cond_init(&encoder->ready, NULL);
+
+    encoder->workerCount = (threads > 1) ? threads : 1;
+    encoder->workers = malloc(encoder->workerCount * sizeof(pthread_t));
+    int i;
+    for(i = 0; i < encoder->workerCount; i++){
+      if(pthread_create(&encoder->workers[i], NULL, encoderWorker, encoder) != 0){
+        fprintf(stderr, "Error: Could not start the encoder threads\n");
+        encoder->workerCount = i;
+        stopWorkers(encoder);
+        freePng(encoder);
+        free(encoder);
+        return NULL;
+      }
+    }
+  }
+  else if(encoder->format == FORMAT_QOI){
+    encoder->qoi = malloc(14 + (size_t)width * height * 4 + 8);
+    memcpy(encoder->qoi, "qoif", 4);
+    writeInt(encoder->qoi + 4, width);
+    writeInt(encoder->qoi + 8, height);
+    encoder->qoi[12] = 3; //RGB
+    encoder->qoi[13] = 0; //sRGB
+    encoder->qoiSize = 14;
+    memset(encoder->qoiIndex, 0, sizeof(encoder->qoiIndex)); //RGBA like the decoder, starts at 0,0,0,0
+    memcpy(encoder->qoiPrevious, "\0\0\0\xff", 4);
+    encoder->rowsLeft = calloc(height, sizeof(int));
+    pthread_mutex_init(&encoder->mutex, NULL);
+  }
+  return encoder;
+}
+
+//Tell the encoder that the image rows [row0, row1[ are rendered
+void encodeRows(encoders encoder, int row0, int row1){
+  if(encoder == NULL || encoder->format == FORMAT_PPM){
+    return;
+  }
+  pthread_mutex_lock(&encoder->mutex);
+  int y;
+  if(encoder->format == FORMAT_QOI){ //Encode the rendered rows that follow the last encoded one
+    for(y = row0; y < row1; y++){
+      encoder->rowsLeft[y] = 1;
+    }
+    int row1 = encoder->qoiRow;
+    while(row1 < encoder->height && encoder->rowsLeft[row1]){
+      row1++;
+    }
+    if(row1 > encoder->qoiRow){
+      double start = now();
+      encodeQoiRows(encoder, row1);
+      encoder->encodeTime += now() - start;
+    }
+    pthread_mutex_unlock(&encoder->mutex);
+    return;
+  }
+  for(y = row0; y < row1; y++){
+    int band = y / encoder->bandHeight;
+    if(--encoder->rowsLeft[band] == 0){
+      encoder->queue[encoder->queueEnd++] = band;
+      pthread_cond_signal(&encoder->ready);
+    }
+  }
+  pthread_mutex_unlock(&encoder->mutex);
+}
+
+//Wait for the encoding to complete, write the file and report its size, return 0 or ERROR_WRITING
+//The file is not written if rows are missing
+int finishEncoder(encoders encoder){
+  double start = now();
+  size_t bytes = 0;
+  int error = 0;
+  int i;
+
+  if(encoder->format == FORMAT_PNG){
+    stopWorkers(encoder);
+    for(i = 0; i < encoder->bandCount && !error; i++){
+      if(encoder->bands[i] == NULL){
+        fprintf(stderr, "Error: Rows missing in image \"%s\"\n", encoder->filename);
+        error = ERROR_WRITING;
+      }
+    }
+    if(!error){
+      error = writePng(encoder, &bytes);
+    }
+    freePng(encoder);
+  }
+  else if(encoder->format == FORMAT_QOI){
+    error = writeQoi(encoder, &bytes);
+    encoder->encodeTime += now() - start;
+    free(encoder->qoi);
+    free(encoder->rowsLeft);
+    pthread_mutex_destroy(&encoder->mutex);
+  }
+  else{
+    error = createScene(encoder->filename, encoder->data, encoder->width, encoder->height);
+    bytes = (size_t)encoder->width * encoder->height * 3;
+    encoder->encodeTime = now() - start;
+  }
+  double finishTime = now() - start;
+
+  if(!error){
+    printf("\nOutput : %s, %zu bytes, encoded in %lf ms (%lf ms after rendering)\n", encoder->filename, bytes, encoder->encodeTime * 1000, finishTime * 1000);
+  }
+  free(encoder);
+  return error;
+}
+
+//Stop the encoder and free it without writing the file, when the image will not be rendered
+void abortEncoder(encoders encoder){
+  if(encoder->format == FORMAT_PNG){
+    stopWorkers(encoder);
+    freePng(encoder);
+  }
+  else if(encoder->format == FORMAT_QOI){
+    free(encoder->qoi);
+    free(encoder->rowsLeft);
+    pthread_mutex_destroy(&encoder->mutex);
+  }
+  free(encoder);
+}
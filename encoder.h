@@ -0,0 +1,60 @@
+#ifndef __ENCODER
+#define __ENCODER
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define FORMAT_PPM 0
+#define FORMAT_QOI 1
+#define FORMAT_PNG 2
+
+#define PNG_LEVEL 6
+
+// Output image encoded while the renderer fills data
+// PNG bands are deflated by worker threads as soon as all their rows are rendered,
+// QOI rows are encoded as soon as all the rows above them are rendered
+typedef struct encoder{
+  char* filename;
+  int format;
+  unsigned char* data; // width * height * 3, rows from top to bottom
+  int width;
+  int height;
+  int bandHeight;
+  int bandCount;
+  int* rowsLeft; // rows still to render in each band (PNG), 1 for each rendered row (QOI)
+  unsigned char** bands; // compressed bands (PNG)
+  size_t* bandSizes;
+  unsigned long* bandAdlers;
+  int* queue; // bands ready to compress
+  int queueStart, queueEnd;
+  int finished; // all rows rendered
+  int workerCount;
+  pthread_t* workers;
+  pthread_mutex_t mutex;
+  pthread_cond_t ready;
+  double encodeTime; // seconds spent encoding, all threads
+  unsigned char* qoi; // QOI stream (header and encoded rows)
+  size_t qoiSize;
+  int qoiRow; // next row to encode
+  int qoiRun;
+  unsigned char qoiIndex[64][4];
+  unsigned char qoiPrevious[4];
+} *encoders;
+
+int createScene(char* ppm, unsigned char* data, int width, int height);
+
+int createPfm(char* pfm, float* data, int width, int height);
+
+int imageFormat(char* filename);
+
+encoders startEncoder(char* filename, unsigned char* data, int width, int height, int bandHeight, int threads);
+
+void encodeRows(encoders encoder, int row0, int row1);
+
+int finishEncoder(encoders encoder);
+
+void abortEncoder(encoders encoder);
+
+#endif
@@ -1,60 +1,58 @@
 #include "json_parser.h"
 
-int line = 1;
-
 // Read and exit if EOF or return it
-int readChar(FILE* json) {
-  int c = fgetc(json);
+int readChar(parsers parser) {
+  int c = fgetc(parser->json);
   #ifdef DEBUG
     printf("%c", c);
   #endif
   if (c == '\n') {
-    line++;
+    parser->line++;
   }
   if (c == EOF) {
-    fprintf(stderr, "Error: Unexpected end of file on line number %d.\n", line);
-    exit(ERROR_PARSER);
+    fprintf(stderr, "Error: Unexpected end of file on line number %d.\n", parser->line);
+    longjmp(parser->error, ERROR_PARSER);
   }
   return c;
 }
 
 //Read the next string on the file and exit if no string detected
-char* readString(FILE* json) {
+char* readString(parsers parser) {
   char buffer[MAX_STRING_LENGHT+1];
-  int c = readChar(json);
+  int c = readChar(parser);
   if (c != '"') {
-    fprintf(stderr, "Error: Expected string on line %d.\n", line);
-    exit(ERROR_PARSER);
+    fprintf(stderr, "Error: Expected string on line %d.\n", parser->line);
+    longjmp(parser->error, ERROR_PARSER);
   }
-  c = readChar(json);
+  c = readChar(parser);
   int i = 0;
   while (c != '"') {
     if (i >= 128) {
       fprintf(stderr, "Error: Strings longer than 128 characters in length are not supported.\n");
-      exit(ERROR_PARSER);
+      longjmp(parser->error, ERROR_PARSER);
     }
     if (c == '\\') {
       fprintf(stderr, "Error: Strings with escape codes are not supported.\n");
-      exit(ERROR_PARSER);
+      longjmp(parser->error, ERROR_PARSER);
     }
     if (c < 32 || c > 126) {
       fprintf(stderr, "Error: Strings may contain only ascii characters.\n");
-      exit(ERROR_PARSER);
+      longjmp(parser->error, ERROR_PARSER);
     }
     buffer[i] = c;
     i += 1;
-    c = readChar(json);
+    c = readChar(parser);
   }
   buffer[i] = 0;
   return strdup(buffer);
 }
 
 //Read the next number on the file and exit if no number detected
-double readNumber(FILE* json) {
+double readNumber(parsers parser) {
   double value;
-  if(fscanf(json, "%lf", &value) == EOF){
-    fprintf(stderr, "Error: Unexpected end of file on line number %d.\n", line);
-    exit(ERROR_PARSER);
+  if(fscanf(parser->json, "%lf", &value) == EOF){
+    fprintf(stderr, "Error: Unexpected end of file on line number %d.\n", parser->line);
+    longjmp(parser->error, ERROR_PARSER);
   }
   #ifdef DEBUG
     printf("%lf", value);
@@ -63,126 +61,193 @@ double readNumber(FILE* json) {
 }
 
 //Check if next character is the one given in parameter expected, exit if not
-void expectChar(FILE* json, int expected) {
-  int c = readChar(json);
+void expectChar(parsers parser, int expected) {
+  int c = readChar(parser);
   if (c != expected){
-    fprintf(stderr, "Error: Expected '%c' on line %d.\n", expected, line);
-    exit(ERROR_PARSER);
+    fprintf(stderr, "Error: Expected '%c' on line %d.\n", expected, parser->line);
+    longjmp(parser->error, ERROR_PARSER);
   }
 }
 
 //Read all the space character
-void skipSpace(FILE* json){
+void skipSpace(parsers parser){
   int c;
   do{
-    c = fgetc(json);
+    c = fgetc(parser->json);
     if(c == '\n'){
-      line++;
+      parser->line++;
     }
   } while(isspace(c));
-  ungetc(c,json);
+  ungetc(c, parser->json);
 }
 
 //Read the next vector on the file
-double* ReadVector(FILE* json) {
+double* ReadVector(parsers parser) {
   double* v = malloc(3*sizeof(double));
-  expectChar(json, '[');
-  skipSpace(json);
-  v[0] = readNumber(json);
-  skipSpace(json);
-  expectChar(json, ',');
-  skipSpace(json);
-  v[1] = readNumber(json);
-  skipSpace(json);
-  expectChar(json, ',');
-  skipSpace(json);
-  v[2] = readNumber(json);
-  skipSpace(json);
-  expectChar(json, ']');
+  expectChar(parser, '[');
+  skipSpace(parser);
+  v[0] = readNumber(parser);
+  skipSpace(parser);
+  expectChar(parser, ',');
+  skipSpace(parser);
+  v[1] = readNumber(parser);
+  skipSpace(parser);
+  expectChar(parser, ',');
+  skipSpace(parser);
+  v[2] = readNumber(parser);
+  skipSpace(parser);
+  expectChar(parser, ']');
   return v;
 }
 
-//Malloc an object an set all vector to 0
+//Replace a vector of the scene by a parsed one
+static void replaceVector(double** vector, double* value){
+  free(*vector);
+  *vector = value;
+}
+
+//Malloc an object an set all values and vectors to 0
 objectList createObject(){
-  objectList object = (objectList)malloc(sizeof(*object));
+  objectList object = (objectList)calloc(1, sizeof(*object));
   object->diffuseColor = getVector(0,0,0);
   object->specularColor = getVector(0,0,0);
   object->position = getVector(0,0,0);
-  object->plane.normal = getVector(0,0,0);
   object->next = NULL;
   return object;
 }
 
 lightList createLight(){
-  lightList light = (lightList)malloc(sizeof(*light));
+  lightList light = (lightList)calloc(1, sizeof(*light));
   light->color = getVector(0,0,0);
   light->position = getVector(0,0,0);
   light->direction = getVector(0,0,0);
+  light->edgeU = getVector(0,0,0);
+  light->edgeV = getVector(0,0,0);
+  light->samples = AREA_SAMPLES;
   light->next = NULL;
   return light;
 }
 
-components parseFile(char* filename, double* width, double* height) {
+//Malloc a camera at the origin looking down +Z
+cameraList createCamera(){
+  cameraList camera = (cameraList)calloc(1, sizeof(*camera));
+  camera->position = getVector(0,0,0);
+  camera->up = getVector(0,1,0);
+  camera->lookAt = NULL;
+  camera->next = NULL;
+  return camera;
+}
 
-  #ifdef DEBUG
-    printf("Starting reading file %s\n", filename);
-  #endif
+//Free all objects, lights and cameras of a scene
+void freeComponents(components comp){
+  objectList object = comp->objects;
+  while(object != NULL){
+    objectList next = object->next;
+    free(object->diffuseColor);
+    free(object->specularColor);
+    free(object->position);
+    if(object->kind == 1){
+      free(object->plane.normal);
+    }
+    else if(object->kind == 2){
+      freeMesh(object->mesh.data);
+      free(object->mesh.file);
+    }
+    free(object);
+    object = next;
+  }
+  lightList light = comp->lights;
+  while(light != NULL){
+    lightList next = light->next;
+    free(light->color);
+    free(light->position);
+    free(light->direction);
+    free(light->edgeU);
+    free(light->edgeV);
+    free(light);
+    light = next;
+  }
+  cameraList camera = comp->cameras;
+  while(camera != NULL){
+    cameraList next = camera->next;
+    free(camera->name);
+    free(camera->position);
+    free(camera->lookAt);
+    free(camera->up);
+    free(camera);
+    camera = next;
+  }
+  free(comp);
+}
 
+//Resolve a path found in the scene file from the directory of the scene file
+char* relativePath(char* filename, char* path){
+  char* slash = strrchr(filename, '/');
+  if(path[0] == '/' || slash == NULL){
+    return strdup(path);
+  }
+  int dirLenght = slash - filename + 1;
+  char* result = malloc(dirLenght + strlen(path) + 1);
+  memcpy(result, filename, dirLenght);
+  strcpy(result + dirLenght, path);
+  return result;
+}
+
+//Parse the objects, lights and cameras of the scene into comp, jump to parser->error on error
+static void parseObjects(parsers parser, components comp) {
   int c;
   int objectNumber = 0;
-  FILE* json = fopen(filename, "r");
-
   int currentKind;
 
-  components comp = (components)malloc(sizeof(*comp));
-  objectList tempList = createObject();
-  lightList tempLights = createLight();
+  objectList tempList = comp->objects;
+  lightList tempLights = comp->lights;
   objectList previousObject = NULL;
   lightList previousLight = NULL;
-  comp->objects = tempList;
-  comp->lights = tempLights;
-
-  if (json == NULL) {
-    fprintf(stderr, "Error: Could not open file \"%s\"\n", filename);
-    exit(ERROR_PARSER);
-  }
+  cameraList tempCamera = NULL;
 
   // Find the beginning of the list
-  skipSpace(json);
-  expectChar(json, '[');
-  skipSpace(json);
+  skipSpace(parser);
+  expectChar(parser, '[');
+  skipSpace(parser);
 
   // Find all the objects
   while (objectNumber < MAX_OBJECT) {
     objectNumber++;
     #ifdef DEBUG
-      printf("\nReading object number %d at line %d\n", objectNumber, line);
+      printf("\nReading object number %d at line %d\n", objectNumber, parser->line);
     #endif
 
-    c = readChar(json);
+    c = readChar(parser);
     if (c == ']') {
       fprintf(stderr, "Error: This is the worst scene file EVER.\n");
-      fclose(json);
-      exit(ERROR_PARSER);
+      longjmp(parser->error, ERROR_PARSER);
     }
     if (c == '{') {
-      skipSpace(json);
+      skipSpace(parser);
 
       // Parse the object
-      char* key = readString(json);
+      char* key = readString(parser);
       if (strcmp(key, "type") != 0) {
-        fprintf(stderr, "Error: Expected \"type\" key on line number %d.\n", line);
-        exit(ERROR_PARSER);
+        fprintf(stderr, "Error: Expected \"type\" key on line number %d.\n", parser->line);
+        free(key);
+        longjmp(parser->error, ERROR_PARSER);
       }
+      free(key);
 
-      skipSpace(json);
-      expectChar(json, ':');
-      skipSpace(json);
+      skipSpace(parser);
+      expectChar(parser, ':');
+      skipSpace(parser);
 
-      char* value = readString(json);
+      char* value = readString(parser);
 
       if (strcmp(value, "camera") == 0) {
         currentKind = -1 ;
+        if(tempCamera == NULL){
+          tempCamera = comp->cameras = createCamera();
+        }
+        else{
+          tempCamera = tempCamera->next = createCamera();
+        }
       }
       else if (strcmp(value, "sphere") == 0) {
         currentKind = 0 ;
@@ -200,6 +265,19 @@ components parseFile(char* filename, double* width, double* height) {
           tempList = createObject();
         }
         tempList->kind = 1;
+        tempList->plane.normal = getVector(0,0,0);
+        if(previousObject != NULL){
+          previousObject->next = tempList;
+        }
+      }
+      else if (strcmp(value, "mesh") == 0) {
+        currentKind = 2 ;
+        if(tempList == NULL){
+          tempList = createObject();
+        }
+        tempList->kind = 2;
+        tempList->mesh.data = NULL;
+        tempList->mesh.file = NULL;
         if(previousObject != NULL){
           previousObject->next = tempList;
         }
@@ -214,40 +292,75 @@ components parseFile(char* filename, double* width, double* height) {
         }
       }
       else {
-        fprintf(stderr, "Error: Unknown type, \"%s\", on line number %d.\n", value, line);
-        exit(ERROR_PARSER);
+        fprintf(stderr, "Error: Unknown type, \"%s\", on line number %d.\n", value, parser->line);
+        free(value);
+        longjmp(parser->error, ERROR_PARSER);
       }
+      free(value);
 
-      skipSpace(json);
+      skipSpace(parser);
 
       //Read all fields
       while (1) {
-        c = readChar(json);
+        c = readChar(parser);
 
         //Check if end of object
         if (c == '}') {
+          if(currentKind == 2){
+            if(tempList->mesh.file == NULL){
+              fprintf(stderr, "Error: Mesh without \"file\" on line %d.\n", parser->line);
+              longjmp(parser->error, ERROR_PARSER);
+            }
+            char* meshFile = relativePath(parser->filename, tempList->mesh.file);
+            tempList->mesh.data = loadMesh(meshFile, tempList->position);
+            free(meshFile);
+            if(tempList->mesh.data == NULL){
+              longjmp(parser->error, ERROR_PARSER);
+            }
+          }
           break;
         }
         //else read field
         else if (c == ',') {
-          skipSpace(json);
-          char* key = readString(json);
-          skipSpace(json);
-          expectChar(json, ':');
-          skipSpace(json);
+          skipSpace(parser);
+          char* key = readString(parser);
+          skipSpace(parser);
+          expectChar(parser, ':');
+          skipSpace(parser);
 
-          if ((strcmp(key, "width") == 0) || (strcmp(key, "height") == 0) || (strcmp(key, "radius") == 0) || (strcmp(key, "radial-a0") == 0)
+          if (currentKind != -1 && ((strcmp(key, "width") == 0) || (strcmp(key, "height") == 0) || (strcmp(key, "fov") == 0)
+             || (strcmp(key, "look_at") == 0) || (strcmp(key, "up") == 0))) {
+            fprintf(stderr, "Error: Camera property, \"%s\", outside of a camera on line %d.\n", key, parser->line);
+            free(key);
+            longjmp(parser->error, ERROR_PARSER);
+          }
+          //The sphere radius and the plane normal share their place with the mesh data
+          else if ((strcmp(key, "radius") == 0 && currentKind != 0 && currentKind != -2) || (strcmp(key, "normal") == 0 && currentKind != 1)) {
+            fprintf(stderr, "Error: Property, \"%s\", not allowed on this type on line %d.\n", key, parser->line);
+            free(key);
+            longjmp(parser->error, ERROR_PARSER);
+          }
+          else if ((strcmp(key, "width") == 0) || (strcmp(key, "height") == 0) || (strcmp(key, "radius") == 0) || (strcmp(key, "radial-a0") == 0)
           || (strcmp(key, "radial-a1") == 0) || (strcmp(key, "radial-a2") == 0) || (strcmp(key, "angular-a0") == 0) || (strcmp(key, "theta") == 0)
-          || (strcmp(key, "reflectivity") == 0) || (strcmp(key, "refractivity") == 0) || (strcmp(key, "ior") == 0)) {
-            double value = readNumber(json);
-            if(strcmp(key, "radius") == 0){
+          || (strcmp(key, "reflectivity") == 0) || (strcmp(key, "refractivity") == 0) || (strcmp(key, "ior") == 0) || (strcmp(key, "samples") == 0) || (strcmp(key, "fov") == 0)) {
+            double value = readNumber(parser);
+            if(strcmp(key, "radius") == 0 && currentKind == -2){
+              tempLights->radius = value;
+            }
+            else if(strcmp(key, "radius") == 0){
               tempList->sphere.radius = value;
             }
+            else if(strcmp(key, "samples") == 0){
+              tempLights->samples = value;
+            }
             else if(strcmp(key, "width") == 0){
-              *width = value;
+              tempCamera->width = value;
             }
             else if(strcmp(key, "height") == 0){
-              *height = value;
+              tempCamera->height = value;
+            }
+            else if(strcmp(key, "fov") == 0){
+              tempCamera->fov = value;
             }
             else if(strcmp(key, "radial-a0") == 0){
               tempLights->radA0 = value;
@@ -275,45 +388,87 @@ components parseFile(char* filename, double* width, double* height) {
             }
           }
           else if ((strcmp(key, "color") == 0) || (strcmp(key, "position") == 0) || (strcmp(key, "normal") == 0) || (strcmp(key, "diffuse_color") == 0)
-             || (strcmp(key, "specular_color") == 0) || (strcmp(key, "direction") == 0)) {
-            double* value = ReadVector(json);
+             || (strcmp(key, "specular_color") == 0) || (strcmp(key, "direction") == 0) || (strcmp(key, "edge_u") == 0) || (strcmp(key, "edge_v") == 0)
+             || (strcmp(key, "look_at") == 0) || (strcmp(key, "up") == 0)) {
+            double* value = ReadVector(parser);
             if(strcmp(key, "diffuse_color") == 0){
-              tempList->diffuseColor = value;
+              replaceVector(&tempList->diffuseColor, value);
             }
             else if(strcmp(key, "specular_color") == 0){
-              tempList->specularColor = value;
+              replaceVector(&tempList->specularColor, value);
             }
             else if(strcmp(key, "position") == 0){
               if(currentKind >= 0){
-                tempList->position = value;
+                replaceVector(&tempList->position, value);
+              }
+              else if(currentKind == -1){
+                replaceVector(&tempCamera->position, value);
               }
               else{
-                tempLights->position = value;
+                replaceVector(&tempLights->position, value);
               }
             }
             else if(strcmp(key, "normal") == 0){
-              tempList->plane.normal = value;
+              replaceVector(&tempList->plane.normal, value);
+              normalize(value); //Once here, planeIntersection only reads it
             }
             else if(strcmp(key, "color") == 0){
-              tempLights->color = value;
+              replaceVector(&tempLights->color, value);
+            }
+            else if(strcmp(key, "edge_u") == 0){
+              replaceVector(&tempLights->edgeU, value);
+            }
+            else if(strcmp(key, "edge_v") == 0){
+              replaceVector(&tempLights->edgeV, value);
+            }
+            else if(strcmp(key, "look_at") == 0){
+              replaceVector(&tempCamera->lookAt, value);
+            }
+            else if(strcmp(key, "up") == 0){
+              replaceVector(&tempCamera->up, value);
+            }
+            else{
+              replaceVector(&tempLights->direction, value);
+            }
+          }
+          else if (strcmp(key, "name") == 0 && currentKind == -1) {
+            tempCamera->name = readString(parser);
+          }
+          else if (strcmp(key, "file") == 0 && currentKind == 2) {
+            tempList->mesh.file = readString(parser);
+          }
+          else if (strcmp(key, "shape") == 0 && currentKind == -2) {
+            char* shape = readString(parser);
+            if(strcmp(shape, "point") == 0){
+              tempLights->shape = 0;
+            }
+            else if(strcmp(shape, "rectangle") == 0){
+              tempLights->shape = 1;
+            }
+            else if(strcmp(shape, "sphere") == 0){
+              tempLights->shape = 2;
             }
             else{
-              tempLights->direction = value;
+              fprintf(stderr, "Error: Unknown light shape, \"%s\", on line %d.\n", shape, parser->line);
+              longjmp(parser->error, ERROR_PARSER);
             }
+            free(shape);
           }
           else {
-            fprintf(stderr, "Error: Unknown property, \"%s\", on line %d.\n", key, line);
-            exit(ERROR_PARSER);
+            fprintf(stderr, "Error: Unknown property, \"%s\", on line %d.\n", key, parser->line);
+            free(key);
+            longjmp(parser->error, ERROR_PARSER);
           }
-          skipSpace(json);
+          free(key);
+          skipSpace(parser);
         }
         else {
-          fprintf(stderr, "Error: Unexpected value on line %d\n", line);
-          exit(ERROR_PARSER);
+          fprintf(stderr, "Error: Unexpected value on line %d\n", parser->line);
+          longjmp(parser->error, ERROR_PARSER);
         }
       }
-      skipSpace(json);
-      c = readChar(json);
+      skipSpace(parser);
+      c = readChar(parser);
       if (c == ',') {
         if(currentKind >= 0){
           previousObject = tempList;
@@ -323,21 +478,75 @@ components parseFile(char* filename, double* width, double* height) {
           previousLight = tempLights;
           tempLights = tempLights->next;
         }
-        skipSpace(json);
+        skipSpace(parser);
       }
       else if (c == ']') {
-        fclose(json);
         #ifdef DEBUG
           printf("\nEnd of reading\n");
         #endif
-        return comp;
+        if(comp->cameras == NULL){
+          fprintf(stderr, "Error: No camera in the scene file.\n");
+          longjmp(parser->error, ERROR_PARSER);
+        }
+        int id = 0;
+        for(tempList = comp->objects; tempList != NULL; tempList = tempList->next){
+          tempList->id = id++;
+        }
+        id = 0;
+        for(tempLights = comp->lights; tempLights != NULL; tempLights = tempLights->next){
+          tempLights->id = id++;
+          tempLights->cosTheta = cos(tempLights->theta / radToDeg(1));
+        }
+        return;
       }
       else {
-        fprintf(stderr, "Error: Expecting ',' or ']' on line %d.\n", line);
-        exit(ERROR_PARSER);
+        fprintf(stderr, "Error: Expecting ',' or ']' on line %d.\n", parser->line);
+        longjmp(parser->error, ERROR_PARSER);
       }
     }
   }
   fprintf(stderr, "Error: Number of object superior to %d.\n", MAX_OBJECT);
-  exit(ERROR_PARSER);
+  longjmp(parser->error, ERROR_PARSER);
+}
+
+//Parse a scene from an open stream, mesh paths are relative to the directory of filename
+//Return 0 and the scene in result, or an error code
+int parseStream(FILE* json, char* filename, components* result) {
+  struct parser parser;
+  parser.json = json;
+  parser.filename = filename;
+  parser.line = 1;
+
+  components comp = (components)malloc(sizeof(*comp));
+  comp->objects = createObject();
+  comp->lights = createLight();
+  comp->cameras = NULL;
+
+  int error = setjmp(parser.error);
+  if(error){
+    freeComponents(comp);
+    *result = NULL;
+    return error;
+  }
+  parseObjects(&parser, comp);
+  *result = comp;
+  return 0;
+}
+
+//Parse a scene file, return 0 and the scene in result, or an error code
+int parseFile(char* filename, components* result) {
+
+  #ifdef DEBUG
+    printf("Starting reading file %s\n", filename);
+  #endif
+
+  FILE* json = fopen(filename, "r");
+  if (json == NULL) {
+    fprintf(stderr, "Error: Could not open file \"%s\"\n", filename);
+    *result = NULL;
+    return ERROR_PARSER;
+  }
+  int error = parseStream(json, filename, result);
+  fclose(json);
+  return error;
 }
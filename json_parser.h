@@ -6,31 +6,48 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <setjmp.h>
 #include "raytracer.h"
 
 //#define DEBUG
 
 #define MAX_STRING_LENGHT 128
-#define MAX_OBJECT 128
+#define MAX_OBJECT 65536
 
 #define ERROR_PARSER 1
 
-int readChar(FILE* json);
+// Scene file being parsed, errors jump back to parseStream
+typedef struct parser{
+  FILE* json;
+  char* filename; // mesh paths are relative to its directory
+  int line;
+  jmp_buf error;
+} *parsers;
 
-void expectChar(FILE* json, int c);
+int readChar(parsers parser);
 
-void skipSpace(FILE* json);
+void expectChar(parsers parser, int c);
 
-char* readString(FILE* json);
+void skipSpace(parsers parser);
 
-double readNumber(FILE* json);
+char* readString(parsers parser);
 
-double* ReadVector(FILE* json);
+double readNumber(parsers parser);
 
-components parseFile(char* filename, double* width, double* height);
+double* ReadVector(parsers parser);
+
+char* relativePath(char* filename, char* path);
+
+int parseStream(FILE* json, char* filename, components* result);
+
+int parseFile(char* filename, components* result);
 
 objectList createObject();
 
 lightList createLight();
 
+cameraList createCamera();
+
+void freeComponents(components comp);
+
 #endif
@@ -0,0 +1,344 @@
+#include <time.h>
+#include "librt.h"
+#include "json_parser.h"
+#include "raytracer.h"
+#include "encoder.h"
+#include "watch.h"
+
+struct rtScene{
+  components comp;
+  struct frame watched; // view kept by rtRenderFiles for rtWatch, no data if none
+  int watchedCamera;
+  char* image;
+  char* heatmap;
+  char* hdr;
+};
+
+static rtScene* newScene(components comp){
+  rtScene* scene = calloc(1, sizeof(*scene));
+  scene->comp = comp;
+  return scene;
+}
+
+//Load a scene file, mesh paths are relative to its directory
+int rtLoadFile(char* filename, rtScene** scene){
+  components comp;
+  *scene = NULL;
+  int error = parseFile(filename, &comp);
+  if(error){
+    return error;
+  }
+  *scene = newScene(comp);
+  return RT_OK;
+}
+
+//Load a scene from size bytes of json, mesh paths are relative to directory (NULL for the current one)
+int rtLoadMemory(char* buffer, size_t size, char* directory, rtScene** scene){
+  components comp;
+  *scene = NULL;
+  FILE* json = fmemopen(buffer, size, "r");
+  if(json == NULL){
+    fprintf(stderr, "Error: Could not read the scene from memory\n");
+    return RT_ERROR_PARSER;
+  }
+
+  char* filename = strdup(""); //relativePath keeps the directory of the file name
+  if(directory != NULL){
+    free(filename);
+    filename = malloc(strlen(directory) + 2);
+    sprintf(filename, "%s/", directory);
+  }
+  int error = parseStream(json, filename, &comp);
+  fclose(json);
+  free(filename);
+  if(error){
+    return error;
+  }
+  *scene = newScene(comp);
+  return RT_OK;
+}
+
+//Print the objects and the lights of a scene on stdout
+void rtPrintScene(rtScene* scene){
+  printObjects(scene->comp->objects);
+  printLights(scene->comp->lights);
+}
+
+int rtCameraCount(rtScene* scene){
+  int count = 0;
+  cameraList camera;
+  for(camera = scene->comp->cameras; camera != NULL; camera = camera->next){
+    count++;
+  }
+  return count;
+}
+
+//Name of a camera in the order of the scene file, NULL if it has none
+const char* rtCameraName(rtScene* scene, int index){
+  cameraList camera = cameraAt(scene->comp, index);
+  return (camera != NULL) ? camera->name : NULL;
+}
+
+//Index of the camera called name, -1 if there is none
+int rtFindCamera(rtScene* scene, const char* name){
+  cameraList camera;
+  int index = 0;
+  for(camera = scene->comp->cameras; camera != NULL; camera = camera->next, index++){
+    if(camera->name != NULL && strcmp(camera->name, name) == 0){
+      return index;
+    }
+  }
+  return -1;
+}
+
+//Size, basis and tiles of the whole image seen by a camera, return 0 or an error code
+static int setupFrame(frames frame, cameraList camera, rtOptions* options){
+  memset(frame, 0, sizeof(*frame));
+  if(options->width <= 0 || options->height <= 0){
+    fprintf(stderr, "Error: Invalid image size %d x %d\n", options->width, options->height);
+    return RT_ERROR_RENDER;
+  }
+  frame->width = options->width;
+  frame->height = options->height;
+  int error = setupView(frame, camera);
+  if(error){
+    return error;
+  }
+  frame->tileColumns = (frame->width + TILE_SIZE - 1) / TILE_SIZE;
+  frame->tileRows = (frame->height + TILE_SIZE - 1) / TILE_SIZE;
+  frame->fastMath = options->fastMath;
+  frame->regionWidth = frame->width;
+  frame->regionHeight = frame->height;
+  return RT_OK;
+}
+
+static double now(){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+//Render views on the thread pool and fill the counters of options
+static void renderStats(components comp, frames* views, encoders* encoder, unsigned char** dirty, int viewCount, rtOptions* options){
+  long rays = rayCount, intersections = intersectionCount, shadings = areaShadings, samples = areaSamples, budget = areaBudget;
+  double start = now();
+  double candidates = renderViews(comp, views, encoder, dirty, viewCount, options->threads);
+  if(options->stats != NULL){
+    options->stats->renderTime = now() - start;
+    options->stats->rays = rayCount - rays;
+    options->stats->intersections = intersectionCount - intersections;
+    options->stats->candidates = candidates;
+    options->stats->areaShadings = areaShadings - shadings;
+    options->stats->areaSamples = areaSamples - samples;
+    options->stats->areaBudget = areaBudget - budget;
+  }
+}
+
+//Render a region of a view in pixels, (x1 - x0) * (y1 - y0) * 3 bytes
+//Only the tiles that overlap the region are rendered, straight into the buffers of the caller
+int rtRender(rtScene* scene, rtOptions* options, unsigned char* pixels){
+  int width = options->width;
+  int height = options->height;
+  int x0 = options->x0, y0 = options->y0, x1 = options->x1, y1 = options->y1;
+  if(x0 == 0 && y0 == 0 && x1 == 0 && y1 == 0){
+    x1 = width;
+    y1 = height;
+  }
+  if(width <= 0 || height <= 0 || x0 < 0 || y0 < 0 || x1 > width || y1 > height || x0 >= x1 || y0 >= y1){
+    fprintf(stderr, "Error: Invalid region [%d, %d[ x [%d, %d[ of a %d x %d image\n", x0, x1, y0, y1, width, height);
+    return RT_ERROR_RENDER;
+  }
+
+  cameraList camera = findCamera(scene->comp, (char*)options->camera);
+  if(camera == NULL){
+    fprintf(stderr, "Error: No camera named \"%s\"\n", options->camera);
+    return RT_ERROR_RENDER;
+  }
+
+  struct frame frame;
+  int error = setupFrame(&frame, camera, options);
+  if(error){
+    return error;
+  }
+  frame.data = pixels;
+  frame.radiance = options->radiance;
+  frame.heat = options->heat;
+  frame.regionX = x0;
+  frame.regionY = y0;
+  frame.regionWidth = x1 - x0;
+  frame.regionHeight = y1 - y0;
+
+  //Frame rows go from bottom to top
+  unsigned char* dirty = calloc(frame.tileColumns * frame.tileRows, sizeof(unsigned char));
+  int tile;
+  for(tile = 0; tile < frame.tileColumns * frame.tileRows; tile++){
+    int tileX = (tile % frame.tileColumns) * TILE_SIZE;
+    int tileY = (tile / frame.tileColumns) * TILE_SIZE;
+    dirty[tile] = tileX < x1 && tileX + TILE_SIZE > x0 && tileY < height - y0 && tileY + TILE_SIZE > height - y1;
+  }
+  frames view = &frame;
+  renderStats(scene->comp, &view, NULL, &dirty, 1, options);
+
+  free(dirty);
+  return RT_OK;
+}
+
+static void freeFrame(frames frame){
+  int tile;
+  if(frame->deps != NULL){
+    for(tile = 0; tile < frame->tileColumns * frame->tileRows; tile++){
+      free(frame->deps[tile].objects);
+      free(frame->deps[tile].lights);
+    }
+  }
+  free(frame->deps);
+  free(frame->data);
+  free(frame->heat);
+  free(frame->radiance);
+}
+
+static void freeWatched(rtScene* scene){
+  freeFrame(&scene->watched);
+  free(scene->image);
+  free(scene->heatmap);
+  free(scene->hdr);
+  memset(&scene->watched, 0, sizeof(scene->watched));
+  scene->image = scene->heatmap = scene->hdr = NULL;
+}
+
+static char* copyString(const char* string){
+  return (string != NULL) ? strdup(string) : NULL;
+}
+
+//Render the whole image of several cameras and write their files, the views share the thread pool
+//The region, camera, radiance and heat of options are not used
+//With options->watch the only output is kept for rtWatch
+int rtRenderFiles(rtScene* scene, rtOptions* options, rtOutput* outputs, int count){
+  if(count < 1 || (options->watch && count > 1)){
+    fprintf(stderr, "Error: %s\n", (count < 1) ? "No view to render" : "Only a single view can be watched");
+    return RT_ERROR_RENDER;
+  }
+  size_t size = (size_t)options->width * options->height * 3;
+  struct frame* frame = calloc(count, sizeof(struct frame));
+  frames* views = malloc(count * sizeof(frames));
+  encoders* encoder = calloc(count, sizeof(encoders));
+  int error = RT_OK;
+  int i;
+
+  for(i = 0; i < count && !error; i++){
+    cameraList camera = cameraAt(scene->comp, outputs[i].camera);
+    if(camera == NULL){
+      fprintf(stderr, "Error: No camera %d in the scene\n", outputs[i].camera);
+      error = RT_ERROR_RENDER;
+      break;
+    }
+    error = setupFrame(&frame[i], camera, options);
+    if(error){
+      break;
+    }
+    views[i] = &frame[i];
+    if(camera->name != NULL){
+      printf("\nCamera %s : width = %lf\theight = %lf\n", camera->name, frame[i].camWidth, frame[i].camHeight);
+    }
+    else{
+      printf("\nCamera : width = %lf\theight = %lf\n", frame[i].camWidth, frame[i].camHeight);
+    }
+    frame[i].data = malloc(size);
+    if(outputs[i].heatmap != NULL){
+      frame[i].heat = malloc(size * sizeof(float));
+    }
+    if(outputs[i].hdr != NULL){
+      frame[i].radiance = malloc(size * sizeof(float));
+    }
+    if(options->watch){
+      frame[i].deps = calloc(frame[i].tileColumns * frame[i].tileRows, sizeof(struct dependency));
+    }
+    if(outputs[i].image != NULL){
+      //Bands are encoded while the next ones render, the views share options->threads encoder threads
+      encoder[i] = startEncoder((char*)outputs[i].image, frame[i].data, frame[i].width, frame[i].height, TILE_SIZE, options->threads / count);
+      if(encoder[i] == NULL){
+        error = RT_ERROR_WRITING;
+      }
+    }
+  }
+
+  int rendered = !error;
+  if(rendered){
+    renderStats(scene->comp, views, encoder, NULL, count, options);
+  }
+
+  for(i = 0; i < count; i++){
+    if(!rendered){ //A view could not be set up, nothing is written and the first error is kept
+      if(encoder[i] != NULL){
+        abortEncoder(encoder[i]);
+      }
+      continue;
+    }
+    if(encoder[i] != NULL && finishEncoder(encoder[i]) != 0){ //Write the image
+      error = RT_ERROR_WRITING;
+    }
+    if(frame[i].heat != NULL && createHeatmap((char*)outputs[i].heatmap, frame[i].heat, frame[i].width, frame[i].height) != 0){
+      error = RT_ERROR_WRITING;
+    }
+    if(frame[i].radiance != NULL && createPfm((char*)outputs[i].hdr, frame[i].radiance, frame[i].width, frame[i].height) != 0){
+      error = RT_ERROR_WRITING;
+    }
+    if(outputs[i].pixels != NULL){
+      memcpy(outputs[i].pixels, frame[i].data, size);
+    }
+  }
+
+  if(options->watch && !error){
+    freeWatched(scene);
+    scene->watched = frame[0];
+    scene->watchedCamera = outputs[0].camera;
+    scene->image = copyString(outputs[0].image);
+    scene->heatmap = copyString(outputs[0].heatmap);
+    scene->hdr = copyString(outputs[0].hdr);
+  }
+  else{
+    for(i = 0; i < count; i++){
+      freeFrame(&frame[i]);
+    }
+  }
+  free(frame);
+  free(views);
+  free(encoder);
+  return error;
+}
+
+//Render the output kept by rtRenderFiles again each time the scene file is saved, only the tiles touched by the changes
+//The scene is replaced by the new version, only returns on error
+int rtWatch(rtScene* scene, char* filename, rtOptions* options){
+  if(scene->watched.data == NULL){
+    fprintf(stderr, "Error: rtWatch needs a view rendered by rtRenderFiles with the watch option\n");
+    return RT_ERROR_RENDER;
+  }
+  char* view = copyString(rtCameraName(scene, scene->watchedCamera)); //The scene is freed by each reload
+  int error = watchScene(filename, scene->image, scene->heatmap, scene->hdr, view, scene->watchedCamera, &scene->comp, &scene->watched, options->threads);
+  free(view);
+  return error;
+}
+
+void rtFreeScene(rtScene* scene){
+  if(scene != NULL){
+    freeWatched(scene);
+    freeComponents(scene->comp);
+    free(scene);
+  }
+}
+
+const char* rtErrorString(int error){
+  switch(error){
+    case RT_OK:
+    return "no error";
+    case RT_ERROR_PARSER:
+    return "invalid scene or mesh file";
+    case RT_ERROR_RENDER:
+    return "invalid camera or render options";
+    case RT_ERROR_WRITING:
+    return "output file could not be written";
+    default:
+    return "unknown error";
+  }
+}
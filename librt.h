@@ -0,0 +1,78 @@
+#ifndef __LIBRT
+#define __LIBRT
+
+#include <stddef.h>
+
+// Embeddable renderer, link with librt.a or librt.so and -lm -lz -lpthread
+// Functions return RT_OK or an error code, messages are printed on stderr
+// Different scenes can be loaded and rendered from several threads at the same time,
+// a scene can be rendered by several threads at once but must not be freed meanwhile
+// Only the functions below are exported by librt.so
+
+#define RT_API __attribute__((visibility("default")))
+
+#define RT_OK 0
+#define RT_ERROR_PARSER 1 // invalid scene or mesh file
+#define RT_ERROR_RENDER 2 // invalid camera or render options
+#define RT_ERROR_WRITING 3 // output file that could not be written
+
+// Parsed scene, its meshes and cameras
+typedef struct rtScene rtScene;
+
+// Counters of a render
+typedef struct rtStats{
+  double renderTime; // seconds, without the end of the file encoding
+  long rays;
+  long intersections; // ray-object, ray-box and ray-triangle tests
+  double candidates; // objects tested by the primary rays of a tile, on average
+  long areaShadings; // points shaded by area lights
+  long areaSamples; // shadow rays toward area lights
+  long areaBudget; // shadow rays toward area lights without adaptive sampling
+} rtStats;
+
+// Image to render, pixels are 3 bytes (RGB) per pixel, rows from top to bottom
+typedef struct rtOptions{
+  const char* camera; // name of the camera, NULL for the first one
+  int width; // size of the whole image
+  int height;
+  int x0, y0, x1, y1; // region to render (x1 and y1 excluded), all 0 for the whole image
+  int threads; // render threads, 1 if less
+  int fastMath; // approximations of pow (see --fast-math)
+  float* radiance; // unclamped colors of the region (3 floats per pixel), NULL if not needed
+  float* heat; // cost of each pixel of the region (time in ns, intersection tests, rays), NULL if not needed
+  rtStats* stats; // counters of the render, NULL if not needed
+  int watch; // keep what rtWatch needs to render the output of rtRenderFiles again
+} rtOptions;
+
+// Files written for a camera by rtRenderFiles, the format comes from the extension
+typedef struct rtOutput{
+  int camera; // index of the camera in the scene
+  const char* image; // .ppm, .qoi or .png, encoded while the other rows render, NULL for none
+  const char* heatmap; // prefix of the render cost images (prefix.ppm and prefix.pfm), NULL for none
+  const char* hdr; // PFM file of the unclamped colors, NULL for none
+  unsigned char* pixels; // copy of the image (width * height * 3 bytes), NULL if not needed
+} rtOutput;
+
+RT_API int rtLoadFile(char* filename, rtScene** scene);
+
+RT_API int rtLoadMemory(char* buffer, size_t size, char* directory, rtScene** scene);
+
+RT_API void rtPrintScene(rtScene* scene);
+
+RT_API int rtCameraCount(rtScene* scene);
+
+RT_API const char* rtCameraName(rtScene* scene, int index);
+
+RT_API int rtFindCamera(rtScene* scene, const char* name);
+
+RT_API int rtRender(rtScene* scene, rtOptions* options, unsigned char* pixels);
+
+RT_API int rtRenderFiles(rtScene* scene, rtOptions* options, rtOutput* outputs, int count);
+
+RT_API int rtWatch(rtScene* scene, char* filename, rtOptions* options);
+
+RT_API void rtFreeScene(rtScene* scene);
+
+RT_API const char* rtErrorString(int error);
+
+#endif
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "librt.h"
+
+//Print the error of the fast math image against the exact one
+void printAccuracy(unsigned char* reference, unsigned char* data, size_t size, double exactTime, double fastTime){
+  double squared = 0;
+  int maxError = 0;
+  size_t i;
+  for(i = 0; i < size; i++){
+    int error = abs((int)data[i] - (int)reference[i]);
+    squared += error * error;
+    if(error > maxError){
+      maxError = error;
+    }
+  }
+  double mse = squared / size;
+  printf("\nFast math accuracy : PSNR = %lf dB\tmax error = %d\n", mse == 0 ? INFINITY : 10 * log10(255 * 255 / mse), maxError);
+  printf("Render time : exact = %lf ms\tfast = %lf ms\tspeedup = %lf\n", exactTime * 1e3, fastTime * 1e3, exactTime / fastTime);
+}
+
+//Output path of a view, the camera name is added before the extension (out.png -> out_left.png)
+char* viewPath(char* path, char* name){
+  char* slash = strrchr(path, '/');
+  char* dot = strrchr(path, '.');
+  if(dot == NULL || (slash != NULL && dot < slash)){
+    dot = path + strlen(path);
+  }
+  char* result = malloc(strlen(path) + strlen(name) + 2);
+  memcpy(result, path, dot - path);
+  sprintf(result + (dot - path), "_%s%s", name, dot);
+  return result;
+}
+
+int main(int argc, char *argv[]){
+  if(argc < 5){
+    fprintf(stderr, "Error: Expected ./raycaster width height input.json output.(ppm|qoi|png) [--heatmap prefix] [--hdr output.pfm] [--watch] [--fast-math] [--accuracy-check] [--views name,name|all] [--threads count]");
+    exit(RT_ERROR_RENDER);
+  }
+
+  char* heatmap = NULL;
+  char* hdr = NULL;
+  char* viewNames = NULL;
+  int watch = 0;
+  int accuracyCheck = 0;
+  int fast = 0;
+  int i;
+  int threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+  for(i = 5; i < argc; i++){
+    if(strcmp(argv[i], "--heatmap") == 0 && i + 1 < argc){
+      heatmap = argv[++i];
+    }
+    else if(strcmp(argv[i], "--hdr") == 0 && i + 1 < argc){
+      hdr = argv[++i];
+    }
+    else if(strcmp(argv[i], "--watch") == 0){
+      watch = 1;
+    }
+    else if(strcmp(argv[i], "--fast-math") == 0){
+      fast = 1;
+    }
+    else if(strcmp(argv[i], "--accuracy-check") == 0){
+      fast = 1;
+      accuracyCheck = 1;
+    }
+    else if(strcmp(argv[i], "--views") == 0 && i + 1 < argc){
+      viewNames = argv[++i];
+    }
+    else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc){
+      threadCount = atoi(argv[++i]);
+    }
+    else{
+      fprintf(stderr, "Error: Unknown option \"%s\"\n", argv[i]);
+      exit(RT_ERROR_RENDER);
+    }
+  }
+  if(threadCount < 1){
+    threadCount = 1;
+  }
+
+  int width = atoi(argv[1]);
+  int height = atoi(argv[2]);
+
+  rtScene* scene;
+  int error = rtLoadFile(argv[3], &scene);
+  if(error){
+    exit(error);
+  }
+
+  //Cameras to render, the first one of the scene without --views
+  int cameraCount = rtCameraCount(scene);
+  int viewCount = 0;
+  int* cameras = malloc((cameraCount + 1) * sizeof(int));
+  char** names = calloc(cameraCount + 1, sizeof(char*));
+  if(viewNames == NULL){
+    cameras[0] = 0;
+    viewCount = 1;
+  }
+  else if(strcmp(viewNames, "all") == 0){
+    for(i = 0; i < cameraCount; i++){
+      cameras[i] = i;
+      if(rtCameraName(scene, i) != NULL){
+        names[i] = strdup(rtCameraName(scene, i));
+      }
+      else{ //Unnamed cameras are numbered
+        names[i] = malloc(32);
+        sprintf(names[i], "camera%d", i);
+      }
+    }
+    viewCount = cameraCount;
+  }
+  else{
+    char* copy = strdup(viewNames);
+    char* name;
+    for(name = strtok(copy, ","); name != NULL; name = strtok(NULL, ",")){
+      int camera = rtFindCamera(scene, name);
+      if(camera < 0){
+        fprintf(stderr, "Error: No camera named \"%s\"\n", name);
+        exit(RT_ERROR_RENDER);
+      }
+      cameras = realloc(cameras, (viewCount + 1) * sizeof(int));
+      names = realloc(names, (viewCount + 1) * sizeof(char*));
+      cameras[viewCount] = camera;
+      names[viewCount++] = strdup(name);
+    }
+    free(copy);
+  }
+  if(viewCount == 0){
+    fprintf(stderr, "Error: No view to render\n");
+    exit(RT_ERROR_RENDER);
+  }
+  if(watch && viewCount > 1){
+    fprintf(stderr, "Error: --watch renders a single view\n");
+    exit(RT_ERROR_RENDER);
+  }
+
+  printf("\nScene : width = %d\theight = %d\n", width, height);
+
+  //The views share the parsed scene and the render threads
+  size_t size = (size_t)width * height * 3;
+  rtOutput* outputs = calloc(viewCount, sizeof(rtOutput));
+  for(i = 0; i < viewCount; i++){
+    outputs[i].camera = cameras[i];
+    outputs[i].image = (names[i] != NULL) ? viewPath(argv[4], names[i]) : strdup(argv[4]);
+    if(heatmap != NULL){
+      outputs[i].heatmap = (names[i] != NULL) ? viewPath(heatmap, names[i]) : strdup(heatmap);
+    }
+    if(hdr != NULL){
+      outputs[i].hdr = (names[i] != NULL) ? viewPath(hdr, names[i]) : strdup(hdr);
+    }
+  }
+  printf("\n");
+  rtPrintScene(scene);
+
+  rtStats stats;
+  rtOptions options;
+  memset(&options, 0, sizeof(options));
+  options.width = width;
+  options.height = height;
+  options.threads = threadCount;
+  options.stats = &stats;
+
+  double exactTime = 0;
+  unsigned char* reference = NULL;
+  unsigned char* data = NULL;
+  if(accuracyCheck){ //Exact render first, not written
+    rtOutput* exact = calloc(viewCount, sizeof(rtOutput));
+    reference = malloc(viewCount * size);
+    data = malloc(viewCount * size);
+    for(i = 0; i < viewCount; i++){
+      exact[i].camera = cameras[i];
+      exact[i].pixels = reference + i * size;
+      outputs[i].pixels = data + i * size;
+    }
+    error = rtRenderFiles(scene, &options, exact, viewCount);
+    exactTime = stats.renderTime;
+    free(exact);
+  }
+
+  options.fastMath = fast;
+  options.watch = watch;
+  if(!error){
+    error = rtRenderFiles(scene, &options, outputs, viewCount);
+  }
+
+  if(!error){
+    printf("\nPrimary candidates per tile : %lf\n", stats.candidates);
+    printf("\nRays traced : %ld\n", stats.rays);
+    if(stats.areaShadings > 0){
+      printf("\nArea light samples per shading point : %lf (%lf without adaptive sampling)\n", (double)stats.areaSamples / stats.areaShadings, (double)stats.areaBudget / stats.areaShadings);
+    }
+    if(accuracyCheck){
+      printAccuracy(reference, data, viewCount * size, exactTime, stats.renderTime);
+    }
+  }
+
+  if(!error && watch){
+    error = rtWatch(scene, argv[3], &options);
+  }
+
+  for(i = 0; i < viewCount; i++){
+    free((char*)outputs[i].image);
+    free((char*)outputs[i].heatmap);
+    free((char*)outputs[i].hdr);
+    free(names[i]);
+  }
+  free(reference);
+  free(data);
+  free(outputs);
+  free(names);
+  free(cameras);
+  rtFreeScene(scene);
+
+  return error;
+}
@@ -0,0 +1,390 @@
+#include "json_parser.h"
+#include "mesh.h"
+
+typedef double v4d __attribute__((vector_size(4*sizeof(double))));
+typedef long long v4l __attribute__((vector_size(4*sizeof(long long))));
+
+//Grow a buffer so it can hold at least needed elements, return 0 if there is not enough memory
+static int growBuffer(void** buffer, int* capacity, int needed, size_t size){
+  if(needed <= *capacity){
+    return 1;
+  }
+  while(*capacity < needed){
+    *capacity = (*capacity == 0) ? MESH_CHUNK : *capacity * 2;
+  }
+  void* grown = realloc(*buffer, (size_t)*capacity * size);
+  if(grown == NULL){
+    fprintf(stderr, "Error: Not enough memory to load mesh.\n");
+    return 0;
+  }
+  *buffer = grown;
+  return 1;
+}
+
+//Convert an OBJ face index (1 based or negative relative) to a vertex index, -1 if invalid
+static int objIndex(long index, int vertexCount, char* filename, int lineNumber){
+  long i = (index > 0) ? index - 1 : vertexCount + index;
+  if(index == 0 || i < 0 || i >= vertexCount){
+    fprintf(stderr, "Error: Invalid face index in \"%s\" on line %d.\n", filename, lineNumber);
+    return -1;
+  }
+  return (int)i;
+}
+
+//Stream an OBJ file line by line, faces with more than 3 vertices are triangulated as fans
+static int loadObj(FILE* file, char* filename, meshes mesh){
+  int vertexCapacity = 0, indexCapacity = 0;
+  char* buffer = NULL;
+  size_t bufferSize = 0;
+  int lineNumber = 0;
+
+  while(getline(&buffer, &bufferSize, file) != -1){
+    lineNumber++;
+    char* c = buffer;
+    while(isspace(*c)) c++;
+
+    if(c[0] == 'v' && isspace(c[1])){
+      if(!growBuffer((void**)&mesh->vertices, &vertexCapacity, 3 * (mesh->vertexCount + 1), sizeof(double))){
+        free(buffer);
+        return ERROR_PARSER;
+      }
+      double* v = mesh->vertices + 3 * mesh->vertexCount;
+      char* end;
+      c++;
+      int i;
+      for(i = 0; i < 3; i++){
+        v[i] = strtod(c, &end);
+        if(end == c){
+          fprintf(stderr, "Error: Expected vertex coordinate in \"%s\" on line %d.\n", filename, lineNumber);
+          free(buffer);
+          return ERROR_PARSER;
+        }
+        c = end;
+      }
+      mesh->vertexCount++;
+    }
+    else if(c[0] == 'f' && isspace(c[1])){
+      int first = -1, previous = -1;
+      char* end;
+      c++;
+      while(1){
+        long index = strtol(c, &end, 10);
+        if(end == c){
+          break;
+        }
+        int current = objIndex(index, mesh->vertexCount, filename, lineNumber);
+        if(current < 0){
+          free(buffer);
+          return ERROR_PARSER;
+        }
+        c = end;
+        while(*c != '\0' && !isspace(*c)) c++; //Skip texture and normal indices
+        if(first < 0){
+          first = current;
+        }
+        else if(previous >= 0){
+          if(!growBuffer((void**)&mesh->indices, &indexCapacity, 3 * (mesh->triangleCount + 1), sizeof(int))){
+            free(buffer);
+            return ERROR_PARSER;
+          }
+          int* triangle = mesh->indices + 3 * mesh->triangleCount;
+          triangle[0] = first;
+          triangle[1] = previous;
+          triangle[2] = current;
+          mesh->triangleCount++;
+        }
+        if(first != current){
+          previous = current;
+        }
+      }
+    }
+  }
+  free(buffer);
+  return 0;
+}
+
+//Read a binary mesh in fixed size chunks after the magic number
+static int loadBinaryMesh(FILE* file, char* filename, meshes mesh){
+  int counts[2];
+  if(fread(counts, sizeof(int), 2, file) != 2 || counts[0] < 0 || counts[1] < 0){
+    fprintf(stderr, "Error: Invalid header in mesh file \"%s\".\n", filename);
+    return ERROR_PARSER;
+  }
+  mesh->vertexCount = counts[0];
+  mesh->triangleCount = counts[1];
+  mesh->vertices = malloc(3 * (size_t)mesh->vertexCount * sizeof(double));
+  mesh->indices = malloc(3 * (size_t)mesh->triangleCount * sizeof(int));
+  if((mesh->vertexCount && mesh->vertices == NULL) || (mesh->triangleCount && mesh->indices == NULL)){
+    fprintf(stderr, "Error: Not enough memory to load mesh.\n");
+    return ERROR_PARSER;
+  }
+
+  float chunk[3 * MESH_CHUNK];
+  size_t total = 3 * (size_t)mesh->vertexCount;
+  size_t done = 0;
+  while(done < total){
+    size_t n = total - done;
+    if(n > 3 * MESH_CHUNK) n = 3 * MESH_CHUNK;
+    if(fread(chunk, sizeof(float), n, file) != n){
+      fprintf(stderr, "Error: Unexpected end of mesh file \"%s\".\n", filename);
+      return ERROR_PARSER;
+    }
+    size_t i;
+    for(i = 0; i < n; i++){
+      mesh->vertices[done + i] = chunk[i];
+    }
+    done += n;
+  }
+
+  total = 3 * (size_t)mesh->triangleCount;
+  if(fread(mesh->indices, sizeof(int), total, file) != total){
+    fprintf(stderr, "Error: Unexpected end of mesh file \"%s\".\n", filename);
+    return ERROR_PARSER;
+  }
+  size_t i;
+  for(i = 0; i < total; i++){
+    if(mesh->indices[i] < 0 || mesh->indices[i] >= mesh->vertexCount){
+      fprintf(stderr, "Error: Invalid vertex index in mesh file \"%s\".\n", filename);
+      return ERROR_PARSER;
+    }
+  }
+  return 0;
+}
+
+//Load an OBJ or binary mesh, move it to position and precompute normals and bounding box, NULL on error
+meshes loadMesh(char* filename, double* position){
+  FILE* file = fopen(filename, "rb");
+  if(file == NULL){
+    fprintf(stderr, "Error: Could not open mesh file \"%s\"\n", filename);
+    return NULL;
+  }
+
+  meshes mesh = (meshes)calloc(1, sizeof(*mesh));
+  char magic[MESH_MAGIC_LENGHT];
+  int error;
+  if(fread(magic, 1, MESH_MAGIC_LENGHT, file) == MESH_MAGIC_LENGHT && memcmp(magic, MESH_MAGIC, MESH_MAGIC_LENGHT) == 0){
+    error = loadBinaryMesh(file, filename, mesh);
+  }
+  else{
+    rewind(file);
+    error = loadObj(file, filename, mesh);
+  }
+  fclose(file);
+
+  if(!error && mesh->triangleCount == 0){
+    fprintf(stderr, "Error: Mesh file \"%s\" has no triangle.\n", filename);
+    error = ERROR_PARSER;
+  }
+  if(error){
+    freeMesh(mesh);
+    return NULL;
+  }
+
+  int i, k;
+  for(k = 0; k < 3; k++){
+    mesh->boxMin[k] = INFINITY;
+    mesh->boxMax[k] = -INFINITY;
+  }
+  for(i = 0; i < mesh->vertexCount; i++){
+    double* v = mesh->vertices + 3 * i;
+    for(k = 0; k < 3; k++){
+      v[k] += position[k];
+      if(v[k] < mesh->boxMin[k]) mesh->boxMin[k] = v[k];
+      if(v[k] > mesh->boxMax[k]) mesh->boxMax[k] = v[k];
+    }
+  }
+
+  mesh->normals = malloc(3 * (size_t)mesh->triangleCount * sizeof(double));
+  for(i = 0; i < mesh->triangleCount; i++){
+    double* v0 = mesh->vertices + 3 * mesh->indices[3 * i];
+    double* v1 = mesh->vertices + 3 * mesh->indices[3 * i + 1];
+    double* v2 = mesh->vertices + 3 * mesh->indices[3 * i + 2];
+    double e1[3] = {v1[0] - v0[0], v1[1] - v0[1], v1[2] - v0[2]};
+    double e2[3] = {v2[0] - v0[0], v2[1] - v0[1], v2[2] - v0[2]};
+    double* N = mesh->normals + 3 * i;
+    N[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    N[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    N[2] = e1[0] * e2[1] - e1[1] * e2[0];
+    double len = sqrt(N[0] * N[0] + N[1] * N[1] + N[2] * N[2]);
+    if(len > 0){
+      N[0] /= len;
+      N[1] /= len;
+      N[2] /= len;
+    }
+  }
+  return mesh;
+}
+
+//Free the buffers of a mesh
+void freeMesh(meshes mesh){
+  if(mesh != NULL){
+    free(mesh->vertices);
+    free(mesh->indices);
+    free(mesh->normals);
+    free(mesh);
+  }
+}
+
+//Shear the ray so its main axis becomes z (Woop, Benthin and Wald watertight test)
+void setupTriangleRay(triangleRay* ray, double* Ro, double* Rd){
+  int kz = 0;
+  if(fabs(Rd[1]) > fabs(Rd[kz])) kz = 1;
+  if(fabs(Rd[2]) > fabs(Rd[kz])) kz = 2;
+  int kx = (kz + 1) % 3;
+  int ky = (kx + 1) % 3;
+  if(Rd[kz] < 0){
+    int swap = kx;
+    kx = ky;
+    ky = swap;
+  }
+  ray->kx = kx;
+  ray->ky = ky;
+  ray->kz = kz;
+  ray->Sx = Rd[kx] / Rd[kz];
+  ray->Sy = Rd[ky] / Rd[kz];
+  ray->Sz = 1.0 / Rd[kz];
+  ray->origin[0] = Ro[0];
+  ray->origin[1] = Ro[1];
+  ray->origin[2] = Ro[2];
+}
+
+//Compute if interserction with a triangle, edges shared by two triangles never let a ray through
+double triangleIntersection(triangleRay* ray, double* v0, double* v1, double* v2){
+  double A[3] = {v0[0] - ray->origin[0], v0[1] - ray->origin[1], v0[2] - ray->origin[2]};
+  double B[3] = {v1[0] - ray->origin[0], v1[1] - ray->origin[1], v1[2] - ray->origin[2]};
+  double C[3] = {v2[0] - ray->origin[0], v2[1] - ray->origin[1], v2[2] - ray->origin[2]};
+
+  double Ax = A[ray->kx] - ray->Sx * A[ray->kz];
+  double Ay = A[ray->ky] - ray->Sy * A[ray->kz];
+  double Bx = B[ray->kx] - ray->Sx * B[ray->kz];
+  double By = B[ray->ky] - ray->Sy * B[ray->kz];
+  double Cx = C[ray->kx] - ray->Sx * C[ray->kz];
+  double Cy = C[ray->ky] - ray->Sy * C[ray->kz];
+
+  double U = Cx * By - Cy * Bx;
+  double V = Ax * Cy - Ay * Cx;
+  double W = Bx * Ay - By * Ax;
+
+  if((U < 0 || V < 0 || W < 0) && (U > 0 || V > 0 || W > 0)){
+    return INFINITY;
+  }
+  double det = U + V + W;
+  if(det == 0){
+    return INFINITY;
+  }
+  double T = ray->Sz * (U * A[ray->kz] + V * B[ray->kz] + W * C[ray->kz]);
+  return T / det;
+}
+
+//Same test as triangleIntersection on 4 consecutive triangles at once
+void triangleIntersection4(triangleRay* ray, double* vertices, int* indices, double* t){
+  double a[3][4], b[3][4], c[3][4];
+  int lane, k;
+  for(lane = 0; lane < 4; lane++){
+    double* v0 = vertices + 3 * indices[3 * lane];
+    double* v1 = vertices + 3 * indices[3 * lane + 1];
+    double* v2 = vertices + 3 * indices[3 * lane + 2];
+    for(k = 0; k < 3; k++){
+      a[k][lane] = v0[k] - ray->origin[k];
+      b[k][lane] = v1[k] - ray->origin[k];
+      c[k][lane] = v2[k] - ray->origin[k];
+    }
+  }
+
+  v4d Az, Bz, Cz, Ax, Ay, Bx, By, Cx, Cy;
+  memcpy(&Az, a[ray->kz], sizeof(v4d));
+  memcpy(&Bz, b[ray->kz], sizeof(v4d));
+  memcpy(&Cz, c[ray->kz], sizeof(v4d));
+  memcpy(&Ax, a[ray->kx], sizeof(v4d));
+  memcpy(&Ay, a[ray->ky], sizeof(v4d));
+  memcpy(&Bx, b[ray->kx], sizeof(v4d));
+  memcpy(&By, b[ray->ky], sizeof(v4d));
+  memcpy(&Cx, c[ray->kx], sizeof(v4d));
+  memcpy(&Cy, c[ray->ky], sizeof(v4d));
+
+  v4d Sx = {ray->Sx, ray->Sx, ray->Sx, ray->Sx};
+  v4d Sy = {ray->Sy, ray->Sy, ray->Sy, ray->Sy};
+  v4d Sz = {ray->Sz, ray->Sz, ray->Sz, ray->Sz};
+  v4d zero = {0, 0, 0, 0};
+  v4d miss = {INFINITY, INFINITY, INFINITY, INFINITY};
+
+  Ax -= Sx * Az;
+  Ay -= Sy * Az;
+  Bx -= Sx * Bz;
+  By -= Sy * Bz;
+  Cx -= Sx * Cz;
+  Cy -= Sy * Cz;
+
+  v4d U = Cx * By - Cy * Bx;
+  v4d V = Ax * Cy - Ay * Cx;
+  v4d W = Bx * Ay - By * Ax;
+  v4d det = U + V + W;
+  v4d T = Sz * (U * Az + V * Bz + W * Cz);
+
+  v4l outside = ((U < zero) | (V < zero) | (W < zero)) & ((U > zero) | (V > zero) | (W > zero));
+  v4l hit = ~outside & (det != zero);
+  v4d result = T / det;
+  result = (v4d)(((v4l)result & hit) | ((v4l)miss & ~hit));
+  memcpy(t, &result, sizeof(v4d));
+}
+
+//Compute the distance to a bounding box, 0 if the origin is inside
+double boxIntersection(double* Ro, double* Rd, double* boxMin, double* boxMax){
+  double tNear = 0;
+  double tFar = INFINITY;
+  int k;
+  for(k = 0; k < 3; k++){
+    double inv = 1.0 / Rd[k];
+    double t0 = (boxMin[k] - Ro[k]) * inv;
+    double t1 = (boxMax[k] - Ro[k]) * inv;
+    if(t0 > t1){
+      double swap = t0;
+      t0 = t1;
+      t1 = swap;
+    }
+    if(t0 > tNear) tNear = t0;
+    if(t1 < tFar) tFar = t1;
+    if(tNear > tFar){
+      return INFINITY;
+    }
+  }
+  return tNear;
+}
+
+//Compute the closest interserction with a mesh, triangle receive the index of the hit triangle
+double meshIntersection(double* Ro, double* Rd, meshes mesh, int* triangle){
+  double bestT = INFINITY;
+  intersectionCount++; //The box test, then every triangle
+  if(boxIntersection(Ro, Rd, mesh->boxMin, mesh->boxMax) == INFINITY){
+    return bestT;
+  }
+  intersectionCount += mesh->triangleCount;
+
+  triangleRay ray;
+  setupTriangleRay(&ray, Ro, Rd);
+
+  int i, lane;
+  int best = -1;
+  double t[4];
+  for(i = 0; i + 4 <= mesh->triangleCount; i += 4){
+    triangleIntersection4(&ray, mesh->vertices, mesh->indices + 3 * i, t);
+    for(lane = 0; lane < 4; lane++){
+      if(t[lane] > 0 && t[lane] < bestT){
+        bestT = t[lane];
+        best = i + lane;
+      }
+    }
+  }
+  for(; i < mesh->triangleCount; i++){
+    int* index = mesh->indices + 3 * i;
+    double ti = triangleIntersection(&ray, mesh->vertices + 3 * index[0], mesh->vertices + 3 * index[1], mesh->vertices + 3 * index[2]);
+    if(ti > 0 && ti < bestT){
+      bestT = ti;
+      best = i;
+    }
+  }
+  if(triangle != NULL){
+    *triangle = best;
+  }
+  return bestT;
+}
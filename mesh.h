@@ -0,0 +1,47 @@
+#ifndef __MESH
+#define __MESH
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define MESH_MAGIC "RTMESH1\n"
+#define MESH_MAGIC_LENGHT 8
+#define MESH_CHUNK 4096
+
+// Triangle mesh with shared vertex and index buffers
+// Binary mesh file: MESH_MAGIC, int32 vertex count, int32 triangle count,
+// then vertex count * 3 float32 positions and triangle count * 3 int32 indices
+typedef struct meshData{
+  int vertexCount;
+  int triangleCount;
+  double* vertices; // 3 doubles per vertex
+  int* indices; // 3 vertex indices per triangle
+  double* normals; // 3 doubles per triangle (face normal)
+  double boxMin[3];
+  double boxMax[3];
+} *meshes;
+
+// Ray transformed for the watertight triangle test
+typedef struct triangleRay{
+  double origin[3];
+  int kx, ky, kz;
+  double Sx, Sy, Sz;
+} triangleRay;
+
+meshes loadMesh(char* filename, double* position);
+
+void freeMesh(meshes mesh);
+
+void setupTriangleRay(triangleRay* ray, double* Ro, double* Rd);
+
+double triangleIntersection(triangleRay* ray, double* v0, double* v1, double* v2);
+
+void triangleIntersection4(triangleRay* ray, double* vertices, int* indices, double* t);
+
+double boxIntersection(double* Ro, double* Rd, double* boxMin, double* boxMax);
+
+double meshIntersection(double* Ro, double* Rd, meshes mesh, int* triangle);
+
+#endif
@@ -0,0 +1,25 @@
+#!/bin/sh
+# Generate a deterministic scene with N small spheres in front of the camera
+# Usage : gen_scene.sh N > scene.json
+
+N=${1:-64}
+
+awk -v n="$N" 'BEGIN {
+  seed = 12345
+  print "["
+  print "  {\"type\": \"camera\", \"width\": 2.0, \"height\": 2.0},"
+  print "  {\"type\": \"plane\", \"normal\": [0, 1, 0], \"diffuse_color\": [0.6, 0.6, 0.6], \"specular_color\": [1, 1, 1], \"position\": [0, -1.5, 0], \"reflectivity\": 0.3, \"refractivity\": 0, \"ior\": 1},"
+  for (i = 0; i < n; i++) {
+    # Park-Miller generator, exact in double precision so every awk agrees
+    seed = (seed * 16807) % 2147483647; x = seed / 2147483647
+    seed = (seed * 16807) % 2147483647; y = seed / 2147483647
+    seed = (seed * 16807) % 2147483647; z = seed / 2147483647
+    seed = (seed * 16807) % 2147483647; r = seed / 2147483647
+    seed = (seed * 16807) % 2147483647; c = seed / 2147483647
+    depth = 4 + 8 * z
+    printf "  {\"type\": \"sphere\", \"radius\": %.4f, \"diffuse_color\": [%.3f, %.3f, %.3f], \"specular_color\": [1, 1, 1], \"position\": [%.4f, %.4f, %.4f], \"reflectivity\": %.2f, \"refractivity\": %.2f, \"ior\": 1},\n", 0.002 + 0.02 * r, c, 1 - c, 0.5, (2 * x - 1) * depth * 0.9, (2 * y - 1) * depth * 0.9, depth, 0.5 * r, 0.3 * c
+  }
+  print "  {\"type\": \"light\", \"color\": [1.5, 1.5, 1.5], \"theta\": 0, \"radial-a2\": 0.125, \"radial-a1\": 0.125, \"radial-a0\": 0.125, \"position\": [2, 4, 1]},"
+  print "  {\"type\": \"light\", \"color\": [1, 1, 1], \"theta\": 0, \"radial-a2\": 0.125, \"radial-a1\": 0.125, \"radial-a0\": 0.125, \"position\": [-3, 2, 0]}"
+  print "]"
+}'
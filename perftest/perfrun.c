@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+//Run a command and print its wall time and peak resident memory
+int main(int argc, char *argv[]){
+  if(argc < 2){
+    fprintf(stderr, "Error: Expected ./perfrun command [arguments]\n");
+    return 1;
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  pid_t pid = fork();
+  if(pid < 0){
+    perror("fork");
+    return 1;
+  }
+  if(pid == 0){
+    execvp(argv[1], argv + 1);
+    perror(argv[1]);
+    _exit(127);
+  }
+
+  int status;
+  struct rusage usage;
+  if(wait4(pid, &status, 0, &usage) < 0){
+    perror("wait4");
+    return 1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  double wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  fflush(stdout);
+  printf("Wall time : %lf\nPeak RSS : %ld\n", wall, usage.ru_maxrss);
+
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
+
+//Read the next number of a ppm header, skipping spaces and comments
+int readHeaderNumber(FILE* file){
+  int c = fgetc(file);
+  while(isspace(c) || c == '#'){
+    if(c == '#'){
+      while(c != '\n' && c != EOF){
+        c = fgetc(file);
+      }
+    }
+    c = fgetc(file);
+  }
+  ungetc(c, file);
+  int value;
+  if(fscanf(file, "%d", &value) != 1){
+    return -1;
+  }
+  return value;
+}
+
+//Load a P6 ppm file, return NULL on error
+unsigned char* readPpm(char* filename, int* width, int* height){
+  FILE* file = fopen(filename, "rb");
+  if(file == NULL){
+    fprintf(stderr, "Error: Could not open file \"%s\"\n", filename);
+    return NULL;
+  }
+  if(fgetc(file) != 'P' || fgetc(file) != '6'){
+    fprintf(stderr, "Error: \"%s\" is not a P6 ppm file\n", filename);
+    fclose(file);
+    return NULL;
+  }
+  *width = readHeaderNumber(file);
+  *height = readHeaderNumber(file);
+  int max = readHeaderNumber(file);
+  fgetc(file);
+  if(*width <= 0 || *height <= 0 || max != 255){
+    fprintf(stderr, "Error: Unsupported ppm header in \"%s\"\n", filename);
+    fclose(file);
+    return NULL;
+  }
+  size_t size = (size_t)*width * *height * 3;
+  unsigned char* data = malloc(size);
+  if(fread(data, 1, size, file) != size){
+    fprintf(stderr, "Error: Could not read data in file \"%s\"\n", filename);
+    free(data);
+    data = NULL;
+  }
+  fclose(file);
+  return data;
+}
+
+//Decode a QOI file as written by the specification, keeping RGB, return NULL on error
+unsigned char* readQoi(char* filename, int* width, int* height){
+  FILE* file = fopen(filename, "rb");
+  if(file == NULL){
+    fprintf(stderr, "Error: Could not open file \"%s\"\n", filename);
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  rewind(file);
+  unsigned char* bytes = malloc(length > 0 ? length : 1);
+  if(length < 22 || fread(bytes, 1, length, file) != (size_t)length || memcmp(bytes, "qoif", 4) != 0){
+    fprintf(stderr, "Error: \"%s\" is not a QOI file\n", filename);
+    fclose(file);
+    free(bytes);
+    return NULL;
+  }
+  fclose(file);
+  *width = bytes[4] << 24 | bytes[5] << 16 | bytes[6] << 8 | bytes[7];
+  *height = bytes[8] << 24 | bytes[9] << 16 | bytes[10] << 8 | bytes[11];
+
+  size_t pixels = (size_t)*width * *height;
+  unsigned char* data = malloc(pixels * 3);
+  unsigned char index[64][4];
+  unsigned char pixel[4] = {0, 0, 0, 255};
+  long p = 14, end = length - 8;
+  size_t i;
+  int run = 0;
+  memset(index, 0, sizeof(index));
+  for(i = 0; i < pixels; i++){
+    if(run > 0){
+      run--;
+    }
+    else if(p < end){
+      int op = bytes[p++];
+      if(op == 0xfe){ //QOI_OP_RGB
+        pixel[0] = bytes[p++];
+        pixel[1] = bytes[p++];
+        pixel[2] = bytes[p++];
+      }
+      else if(op == 0xff){ //QOI_OP_RGBA
+        memcpy(pixel, bytes + p, 4);
+        p += 4;
+      }
+      else if((op & 0xc0) == 0x00){ //QOI_OP_INDEX
+        memcpy(pixel, index[op], 4);
+      }
+      else if((op & 0xc0) == 0x40){ //QOI_OP_DIFF
+        pixel[0] += ((op >> 4) & 3) - 2;
+        pixel[1] += ((op >> 2) & 3) - 2;
+        pixel[2] += (op & 3) - 2;
+      }
+      else if((op & 0xc0) == 0x80){ //QOI_OP_LUMA
+        int next = bytes[p++];
+        int dg = (op & 0x3f) - 32;
+        pixel[0] += dg - 8 + ((next >> 4) & 0x0f);
+        pixel[1] += dg;
+        pixel[2] += dg - 8 + (next & 0x0f);
+      }
+      else{ //QOI_OP_RUN
+        run = op & 0x3f;
+      }
+      memcpy(index[(pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) % 64], pixel, 4);
+    }
+    memcpy(data + 3 * i, pixel, 3);
+  }
+  free(bytes);
+  return data;
+}
+
+//Load a ppm or, from its extension, a QOI image
+unsigned char* readImage(char* filename, int* width, int* height){
+  char* dot = strrchr(filename, '.');
+  if(dot != NULL && strcmp(dot, ".qoi") == 0){
+    return readQoi(filename, width, height);
+  }
+  return readPpm(filename, width, height);
+}
+
+//Compare two ppm (or QOI) images, fail if a pixel channel differ by more than the tolerance
+int main(int argc, char *argv[]){
+  if(argc < 3){
+    fprintf(stderr, "Error: Expected ./ppmdiff reference.(ppm|qoi) image.(ppm|qoi) [tolerance]\n");
+    return 2;
+  }
+  int tolerance = (argc > 3) ? atoi(argv[3]) : 0;
+
+  int width, height, width2, height2;
+  unsigned char* reference = readImage(argv[1], &width, &height);
+  unsigned char* image = readImage(argv[2], &width2, &height2);
+  if(reference == NULL || image == NULL){
+    return 2;
+  }
+  if(width != width2 || height != height2){
+    printf("Max difference : -1\nBad pixels : %d\n", width * height);
+    return 1;
+  }
+
+  int maxDiff = 0;
+  int badPixels = 0;
+  int i, k;
+  for(i = 0; i < width * height; i++){
+    int pixelDiff = 0;
+    for(k = 0; k < 3; k++){
+      int diff = abs(reference[3 * i + k] - image[3 * i + k]);
+      if(diff > pixelDiff) pixelDiff = diff;
+    }
+    if(pixelDiff > maxDiff) maxDiff = pixelDiff;
+    if(pixelDiff > tolerance) badPixels++;
+  }
+  printf("Max difference : %d\nBad pixels : %d\n", maxDiff, badPixels);
+
+  free(reference);
+  free(image);
+  return badPixels > 0;
+}
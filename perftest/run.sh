@@ -0,0 +1,130 @@
+#!/bin/sh
+# Render every scene of perftest/scenes.txt, compare it to its golden image,
+# append timings to the history and flag regressions against the previous runs
+# Each scene is also written as QOI and decoded back to check the encoder
+#
+# Variables : RAYTRACER (./raytracer), TONEMAP (./tonemap), TOLERANCE per channel (2),
+#             THRESHOLD percent of slowdown or memory growth (10),
+#             MIN_SLOWDOWN seconds ignored as timing noise (0.02),
+#             REPEAT renders per scene, the fastest is kept (3),
+#             BASELINE_RUNS previous successful runs whose median is the reference (5),
+#             UPDATE_GOLDEN=1 to rewrite the golden images
+
+DIR=$(dirname "$0")
+RAYTRACER=${RAYTRACER:-./raytracer}
+TONEMAP=${TONEMAP:-./tonemap}
+TOLERANCE=${TOLERANCE:-2}
+THRESHOLD=${THRESHOLD:-10}
+MIN_SLOWDOWN=${MIN_SLOWDOWN:-0.02}
+REPEAT=${REPEAT:-3}
+BASELINE_RUNS=${BASELINE_RUNS:-5}
+HISTORY=${HISTORY:-$DIR/history.csv}
+OUT=$DIR/out
+
+mkdir -p "$OUT"
+if [ ! -f "$HISTORY" ]; then
+  echo "date,commit,scene,width,height,wall_seconds,rays,rays_per_second,peak_rss_kb,max_difference,status" > "$HISTORY"
+fi
+
+DATE=$(date +%Y-%m-%dT%H:%M:%S)
+COMMIT=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+FAILED=0
+
+printf "%-12s %6s %10s %12s %10s %6s  %s\n" scene size wall rays/s rss_kb diff status
+
+while read -r NAME SCENE WIDTH HEIGHT; do
+  case "$NAME" in ''|'#'*) continue ;; esac
+
+  # Generated scenes are named gen:<number of spheres>
+  case "$SCENE" in
+    gen:*)
+      JSON=$OUT/$NAME.json
+      "$DIR/gen_scene.sh" "${SCENE#gen:}" > "$JSON"
+      ;;
+    *)
+      JSON=$SCENE
+      ;;
+  esac
+
+  IMAGE=$OUT/$NAME.ppm
+  GOLDEN=$DIR/golden/$NAME.ppm
+  STATUS=ok
+  BEST=""
+  i=0
+  while [ $i -lt "$REPEAT" ]; do
+    if ! "$DIR/perfrun" "$RAYTRACER" "$WIDTH" "$HEIGHT" "$JSON" "$IMAGE" > "$OUT/$NAME.log" 2>&1; then
+      STATUS=crash
+      break
+    fi
+    WALL=$(awk -F' : ' '/^Wall time/ {print $2}' "$OUT/$NAME.log")
+    if [ -z "$BEST" ] || awk -v a="$WALL" -v b="$BEST" 'BEGIN {exit !(a < b)}'; then
+      BEST=$WALL
+      RSS=$(awk -F' : ' '/^Peak RSS/ {print $2}' "$OUT/$NAME.log")
+      RAYS=$(awk -F' : ' '/^Rays traced/ {print $2}' "$OUT/$NAME.log")
+    fi
+    i=$((i + 1))
+  done
+
+  DIFF=-1
+  if [ "$STATUS" = ok ]; then
+    if [ "$UPDATE_GOLDEN" = 1 ]; then
+      cp "$IMAGE" "$GOLDEN"
+    fi
+    DIFF=$("$DIR/ppmdiff" "$GOLDEN" "$IMAGE" "$TOLERANCE" | awk -F' : ' '/^Max difference/ {print $2}')
+    if ! "$DIR/ppmdiff" "$GOLDEN" "$IMAGE" "$TOLERANCE" > /dev/null; then
+      STATUS=mismatch
+    fi
+    # The QOI output must decode (as the specification does) to the same pixels
+    if ! "$RAYTRACER" "$WIDTH" "$HEIGHT" "$JSON" "$OUT/$NAME.qoi" > /dev/null 2>&1 ||
+       ! "$DIR/ppmdiff" "$IMAGE" "$OUT/$NAME.qoi" 0 > /dev/null; then
+      STATUS=qoi
+    fi
+  fi
+
+  if [ "$STATUS" = ok ]; then
+    # Median of the last successful runs of the same scene at the same size
+    PREVIOUS=$(awk -F, -v s="$NAME" -v w="$WIDTH" -v h="$HEIGHT" -v k="$BASELINE_RUNS" '
+      function median(v, n,    i, j, t) {
+        for (i = 1; i < n; i++) for (j = i + 1; j <= n; j++) if (v[j] < v[i]) {t = v[i]; v[i] = v[j]; v[j] = t}
+        return (n % 2) ? v[(n + 1) / 2] : (v[n / 2] + v[n / 2 + 1]) / 2
+      }
+      $3 == s && $4 == w && $5 == h && $11 == "ok" {n++; wall[n] = $6; rss[n] = $9}
+      END {
+        if (n == 0) {print ""; exit}
+        first = (n > k) ? n - k + 1 : 1
+        for (i = first; i <= n; i++) {m++; lastWall[m] = wall[i]; lastRss[m] = rss[i]}
+        print median(lastWall, m), median(lastRss, m)
+      }' "$HISTORY")
+    STATUS=$(echo "$PREVIOUS" | awk -v wall="$BEST" -v rss="$RSS" -v t="$THRESHOLD" -v m="$MIN_SLOWDOWN" '{
+      status = "ok"
+      if ($1 != "" && wall > $1 * (1 + t / 100) && wall - $1 > m) status = "slower"
+      if ($2 != "" && rss > $2 * (1 + t / 100)) status = (status == "ok") ? "memory" : status "+memory"
+      print status
+    }')
+  else
+    BEST=${BEST:-0}
+    RSS=${RSS:-0}
+    RAYS=${RAYS:-0}
+  fi
+
+  RATE=$(awk -v r="$RAYS" -v w="$BEST" 'BEGIN {printf "%.0f", (w > 0) ? r / w : 0}')
+  echo "$DATE,$COMMIT,$NAME,$WIDTH,$HEIGHT,$BEST,$RAYS,$RATE,$RSS,$DIFF,$STATUS" >> "$HISTORY"
+  printf "%-12s %6s %10s %12s %10s %6s  %s\n" "$NAME" "${WIDTH}x$HEIGHT" "$BEST" "$RATE" "$RSS" "$DIFF" "$STATUS"
+
+  if [ "$STATUS" != ok ]; then
+    FAILED=1
+  fi
+done < "$DIR/scenes.txt"
+
+# Isolated black pixels hit the initial QOI index, the decoder must see the same colors
+"$TONEMAP" "$DIR/qoi_check.pfm" "$OUT/qoi_check.ppm" > /dev/null
+"$TONEMAP" "$DIR/qoi_check.pfm" "$OUT/qoi_check.qoi" > /dev/null
+if ! "$DIR/ppmdiff" "$OUT/qoi_check.ppm" "$OUT/qoi_check.qoi" 0 > /dev/null; then
+  echo "QOI round trip of $DIR/qoi_check.pfm failed"
+  FAILED=1
+fi
+
+if [ $FAILED -ne 0 ]; then
+  echo "Performance test failed, see $HISTORY"
+fi
+exit $FAILED
@@ -1,5 +1,66 @@
+#include <time.h>
+#include <pthread.h>
 #include "json_parser.h"
 #include "raytracer.h"
+#include "encoder.h"
+
+__thread int fastMath = 0; //Set from the frame of each tile
+//Counters are per thread, render threads add theirs to the calling thread when they finish
+__thread long rayCount = 0; //Number of rays traced (primary, shadow, reflected and refracted)
+__thread long intersectionCount = 0; //Number of ray-object, ray-box and ray-triangle tests
+__thread long areaShadings = 0; //Number of points lit by an area light
+__thread long areaSamples = 0; //Number of shadow rays cast toward area lights
+__thread long areaBudget = 0; //Number of shadow rays without adaptive sampling
+__thread dependencies currentDependency = NULL; //Dependencies of the tile being rendered, NULL if not recorded
+
+static inline void dependOnObject(objectList object){
+  if(currentDependency != NULL){
+    currentDependency->objects[object->id] = 1;
+  }
+}
+
+//Remember a light if it can light the point (inside its cone and in front of the surface), N, L and Vo are unit vectors
+static inline void dependOnLight(lightList light, double* N, double* L, double* Vo){
+  if(currentDependency != NULL && dotProduct(N, L) > -1e-9
+     && (light->theta == 0 || dotProduct(Vo, light->direction) >= light->cosTheta)){
+    currentDependency->lights[light->id] = 1;
+  }
+}
+
+//Grow the bounds of the shaded points with a point
+static inline void dependOnPoint(double* point){
+  if(currentDependency != NULL){
+    int k;
+    for(k = 0; k < 3; k++){
+      currentDependency->pointMin[k] = fmin(currentDependency->pointMin[k], point[k]);
+      currentDependency->pointMax[k] = fmax(currentDependency->pointMax[k], point[k]);
+    }
+  }
+}
+
+//Grow the bounds of the secondary rays with the segment [a, b]
+static inline void dependOnSegment(double* a, double* b){
+  if(currentDependency != NULL){
+    int k;
+    for(k = 0; k < 3; k++){
+      currentDependency->boxMin[k] = fmin(currentDependency->boxMin[k], fmin(a[k], b[k]));
+      currentDependency->boxMax[k] = fmax(currentDependency->boxMax[k], fmax(a[k], b[k]));
+    }
+  }
+}
+
+//Remember the end of a reflected or refracted ray, or that it left the scene
+static inline void dependOnRay(double* Ro, double* Rd, double t){
+  if(currentDependency != NULL){
+    if(t == INFINITY){
+      currentDependency->openRays = 1;
+    }
+    else{
+      double end[3] = {Ro[0] + Rd[0] * t, Ro[1] + Rd[1] * t, Ro[2] + Rd[2] * t};
+      dependOnSegment(Ro, end);
+    }
+  }
+}
 
 //Print all object detected in json file
 void printObjects(objectList list){
@@ -11,6 +72,14 @@ void printObjects(objectList list){
       printf("Position : %lf  %lf  %lf\n", list->position[0], list->position[1], list->position[2]);
       printf("Radius : %lf\n", list->sphere.radius);
     }
+    else if(list->kind == 2){
+      printf("Object of kind : mesh\n");
+      printf("Diffuse color : %lf  %lf  %lf\n", list->diffuseColor[0], list->diffuseColor[1], list->diffuseColor[2]);
+      printf("Specular color : %lf  %lf  %lf\n", list->specularColor[0], list->specularColor[1], list->specularColor[2]);
+      printf("Position : %lf  %lf  %lf\n", list->position[0], list->position[1], list->position[2]);
+      printf("File : %s\n", list->mesh.file);
+      printf("Vertices : %d\tTriangles : %d\n", list->mesh.data->vertexCount, list->mesh.data->triangleCount);
+    }
     else{
       printf("Object of kind : plane\n");
       printf("Diffuse color : %lf  %lf  %lf\n", list->diffuseColor[0], list->diffuseColor[1], list->diffuseColor[2]);
@@ -29,7 +98,13 @@ void printObjects(objectList list){
 //Print all lights detected in json file
 void printLights(lightList list){
   while (list != NULL) {
-    if(list->theta == 0){
+    if(list->shape == 1){
+      printf("\n\n Rectangle area light\n");
+    }
+    else if(list->shape == 2){
+      printf("\n\n Sphere area light\n");
+    }
+    else if(list->theta == 0){
       printf("\n\n Point light\n");
     }
     else{
@@ -45,6 +120,16 @@ void printLights(lightList list){
       printf("Theta : %lf\n", list->theta);
       printf("Angular-a0 : %lf\n", list->angA0);
     }
+    if(list->shape == 1){
+      printf("Edge u : %lf  %lf  %lf\n", list->edgeU[0], list->edgeU[1], list->edgeU[2]);
+      printf("Edge v : %lf  %lf  %lf\n", list->edgeV[0], list->edgeV[1], list->edgeV[2]);
+    }
+    else if(list->shape == 2){
+      printf("Radius : %lf\n", list->radius);
+    }
+    if(list->shape != 0){
+      printf("Samples : %d\n", list->samples);
+    }
 
     printf("\n");
     list = list->next;
@@ -52,13 +137,13 @@ void printLights(lightList list){
 }
 
 
-//Compute if interserction with a plane
+//Compute if interserction with a plane, normal is unit length (normalized by the parser)
 double planeIntersection(double* Ro, double* Rd, double* position, double* normal){
   double t = INFINITY;
-  normalize(normal); //Just in case
   double denom = dotProduct(normal, Rd);
   if(sqrt(sqr(denom)) > 0.00001){
-    t = (-dotProduct(subVector(Ro, position), normal)) / denom;
+    double RoSubPosition[3] = {Ro[0] - position[0], Ro[1] - position[1], Ro[2] - position[2]};
+    t = (-dotProduct(RoSubPosition, normal)) / denom;
   }
   return t;
 }
@@ -67,7 +152,7 @@ double planeIntersection(double* Ro, double* Rd, double* position, double* norma
 double sphereIntersection(double* Ro, double* Rd, double* position, double radius){
   double t = INFINITY;
 
-  double* RoSubPosition = subVector(Ro, position);
+  double RoSubPosition[3] = {Ro[0] - position[0], Ro[1] - position[1], Ro[2] - position[2]};
   double b = 2 * dotProduct(Rd, RoSubPosition);
   double c = dotProduct(RoSubPosition, RoSubPosition) - radius;
 
@@ -83,39 +168,67 @@ double sphereIntersection(double* Ro, double* Rd, double* position, double radiu
 }
 
 
-//Write the data in a P6 ppm file
-void createScene(char* ppm, unsigned char* data, int width, int height){
-  FILE* outputFile = fopen(ppm, "w");
 
-  if (outputFile == NULL) {
-    fprintf(stderr, "Error: Could not open file \"%s\"\n", ppm);
-    exit(ERROR_WRITING);
-  }
+static int compareFloat(const void* a, const void* b){
+  float fa = *(const float*)a;
+  float fb = *(const float*)b;
+  return (fa > fb) - (fa < fb);
+}
 
-  if(fprintf(outputFile, "P6\n#Written by raycaster program made by Bruno TESSIER\n%d %d\n255\n", width, height) < 63){
-    fprintf(stderr, "Error: Could not write header in file \"%s\"\n", ppm);
-    exit(ERROR_WRITING);
+//Write the render cost of each pixel as a false colour ppm (time) and a pfm (time in ns, intersection tests, rays)
+//Return 0 or ERROR_WRITING
+int createHeatmap(char* prefix, float* heat, int width, int height){
+  char* filename = malloc(strlen(prefix) + 5);
+  float maxTime = 0;
+  int i;
+
+  //Colours are scaled on the 99th percentile so a few outliers do not darken the whole map
+  float* times = malloc(width * height * sizeof(float));
+  for(i = 0; i < width * height; i++){
+    times[i] = heat[3 * i];
+  }
+  qsort(times, width * height, sizeof(float), compareFloat);
+  float scale = times[(int)(0.99 * (width * height - 1))];
+  maxTime = times[width * height - 1];
+  free(times);
+
+  //False colour : black, blue, green, yellow, red, white
+  static const double ramp[6][3] = {{0, 0, 0}, {0, 0, 1}, {0, 1, 0}, {1, 1, 0}, {1, 0, 0}, {1, 1, 1}};
+  unsigned char* data = malloc(width * height * 3 * sizeof(unsigned char));
+  for(i = 0; i < width * height; i++){
+    double v = (scale > 0) ? 5 * heat[3 * i] / scale : 0;
+    int stop = (v >= 5) ? 4 : (int)v;
+    double f = v - stop;
+    int k;
+    for(k = 0; k < 3; k++){
+      data[3 * i + k] = clamp(ramp[stop][k] * (1 - f) + ramp[stop + 1][k] * f) * 255;
+    }
   }
-  if(fwrite(data, sizeof(char), width * height * 3, outputFile) != (width * height * 3)){
-    fprintf(stderr, "Error: Could not write data in file \"%s\"\n", ppm);
-    exit(ERROR_WRITING);
+  sprintf(filename, "%s.ppm", prefix);
+  int error = createScene(filename, data, width, height);
+  free(data);
+
+  sprintf(filename, "%s.pfm", prefix);
+  error = error || createPfm(filename, heat, width, height);
+
+  if(!error){
+    printf("\nHeatmap : %s.ppm and %s.pfm, slowest pixel %lf ms\n", prefix, prefix, maxTime / 1e6);
   }
-  fclose(outputFile);
+  free(filename);
+  return error ? ERROR_WRITING : 0;
 }
 
 //Compute angular attenuation of a light
-double fAng(double* Vo, double* Vl, double angleMax, double a0){
+double fAng(double* Vo, double* Vl, double angleMax, double cosAngleMax, double a0){
   if(angleMax == 0){
     return 1; //Not spotlight
   }
   double dot = dotProduct(Vo, Vl);
-  double angle = radToDeg(acos(dot));
-
-  if(angle > angleMax){
+  if(dot < cosAngleMax){ //angle > angleMax, cosAngleMax is computed by the parser so no acos is needed
     return 0;
   }
 
-  return (pow(dot, a0));
+  return fastMath ? fastPow(dot, a0) : pow(dot, a0);
 }
 
 //Compute radial attenuation of a light
@@ -126,36 +239,47 @@ double fRad(double dist, double a0, double a1, double a2){
   return 1/(a2*sqr(dist + a1*dist + a0));
 }
 
-//Compute the incident light
-double* diffuse(double* objDiffuse, double* lightColor, double* N, double* L){
+//Compute the incident light in result
+void diffuse(double* result, double* objDiffuse, double* lightColor, double* N, double* L){
   double NL = dotProduct(N, L);
+  setVector(result, 0, 0, 0);
   if(NL > 0){
-    return scaleVector(multVector(objDiffuse, lightColor), NL);
+    setVector(result, objDiffuse[0] * lightColor[0] * NL, objDiffuse[1] * lightColor[1] * NL, objDiffuse[2] * lightColor[2] * NL);
   }
-  return getVector(0,0,0);
 }
 
-//compute the specular light
-double* specular(double* objSpecular, double* lightColor, double* R, double* V,  double* N, double* L, double shininess){
+//compute the specular light in result
+void specular(double* result, double* objSpecular, double* lightColor, double* R, double* V,  double* N, double* L, double shininess){
   double RV = dotProduct(R, V);
   double NL = dotProduct(N, L);
+  setVector(result, 0, 0, 0);
   if(NL > 0 && RV > 0){
-    return scaleVector(multVector(objSpecular, lightColor), pow(RV, shininess));
+    double power = fastMath ? fastPow(RV, shininess) : pow(RV, shininess);
+    setVector(result, objSpecular[0] * lightColor[0] * power, objSpecular[1] * lightColor[1] * power, objSpecular[2] * lightColor[2] * power);
   }
-  return getVector(0,0,0);
 }
 
 //Chek if interserction of a ray to an object
 double shoot(double* Ro, double* Rd, objectList object){
+  return shootPrimitive(Ro, Rd, object, NULL);
+}
+
+//Chek if interserction of a ray to an object, primitive receive the hit triangle of a mesh
+double shootPrimitive(double* Ro, double* Rd, objectList object, int* primitive){
   double t;
 
   switch (object->kind) {
     case 0:
+    intersectionCount++;
     t = sphereIntersection(Ro, Rd, object->position, object->sphere.radius);
     break;
     case 1:
+    intersectionCount++;
     t = planeIntersection(Ro, Rd, object->position, object->plane.normal);
     break;
+    case 2:
+    t = meshIntersection(Ro, Rd, object->mesh.data, primitive); //Counts its box and triangle tests
+    break;
     default:
     fprintf(stderr, "Error: Object of kind unknow (How is it even possible ?)");
     exit(ERROR_RAYCAST);
@@ -163,234 +287,725 @@ double shoot(double* Ro, double* Rd, objectList object){
   return t;
 }
 
-double* getRefractedRay(double* N, double ior1, double ior2, double* Rd){
-  double* a = scaleVector(multVector(N, Rd),1/(norm(multVector(N, Rd))));
-  double* b = multVector(a, N);
+//Compute the refracted ray in refractedRay
+void getRefractedRay(double* refractedRay, double* N, double ior1, double ior2, double* Rd){
+  double NRd[3] = {N[0] * Rd[0], N[1] * Rd[1], N[2] * Rd[2]};
+  double scale = 1/(norm(NRd));
+  double b[3] = {NRd[0] * scale * N[0], NRd[1] * scale * N[1], NRd[2] * scale * N[2]};
 
   double sinTheta = (ior1/ior2) * dotProduct(Rd, b);
   double cosTheta = sqrt(1-(sinTheta*sinTheta));
 
-  double* refractedRay =  subVector(scaleVector(b, sinTheta), scaleVector(N, cosTheta));
-
-  return refractedRay;
+  setVector(refractedRay, b[0] * sinTheta - N[0] * cosTheta, b[1] * sinTheta - N[1] * cosTheta, b[2] * sinTheta - N[2] * cosTheta);
 }
 
-//Compute the direct lightning of an object
-double* directShade(double* color, lightList light, objectList object, double* Rdn, double* Rd, double* Vo, double* Ron, double dist){
-  double* N = NULL;
-  double* L = NULL;
-  double* R = NULL;
-  double* V = NULL;
-
+//Compute the normal vector of an object at the interserction point in N
+void getNormal(objectList object, double* Ron, int primitive, double* N){
   if(object->kind == 1){
-    N = object->plane.normal;
+    memcpy(N, object->plane.normal, 3 * sizeof(double));
+  }
+  else if(object->kind == 2){
+    memcpy(N, object->mesh.data->normals + 3 * primitive, 3 * sizeof(double));
   }
   else{
-    N = subVector(Ron, object->position);
+    setVector(N, Ron[0] - object->position[0], Ron[1] - object->position[1], Ron[2] - object->position[2]);
     normalize(N);
   }
-  L = Rdn;
+}
+
+//Add the direct lightning of an object to color
+void directShade(double* color, lightList light, objectList object, double* N, double* Rdn, double* Rd, double* Vo, double dist){
+  double* L = Rdn;
+  double R[3];
+  double V[3];
+
   normalize(L);
-  R = subVector(scaleVector(N, dotProduct(N, L) * 2),L);
+  double NL2 = dotProduct(N, L) * 2;
+  setVector(R, N[0] * NL2 - L[0], N[1] * NL2 - L[1], N[2] * NL2 - L[2]);
   normalize(R);
-  V = scaleVector(Rd, -1);
+  setVector(V, Rd[0] * -1, Rd[1] * -1, Rd[2] * -1);
   normalize(V);
 
-  double* diffuseColor = diffuse(object->diffuseColor, light->color, N, L);
-  double* specularColor = specular(object->specularColor, light->color, R, V, N, L, 20);
+  double diffuseColor[3];
+  double specularColor[3];
+  diffuse(diffuseColor, object->diffuseColor, light->color, N, L);
+  specular(specularColor, object->specularColor, light->color, R, V, N, L, 20);
 
-  double angAtt = fAng(Vo, light->direction, light->theta, light->angA0);
+  double angAtt = fAng(Vo, light->direction, light->theta, light->cosTheta, light->angA0);
   double radAtt = fRad(dist, light->radA0, light->radA1, light->radA2);
 
   color[0] += angAtt * radAtt * (diffuseColor[0] + specularColor[0]);
   color[1] += angAtt * radAtt * (diffuseColor[1] + specularColor[1]);
   color[2] += angAtt * radAtt * (diffuseColor[2] + specularColor[2]);
+}
+
+//Find the first object between a point and a target (light or sample of an area light), NULL if none
+objectList findOccluder(objectList allObject, double* Ron, double* target){
+  double Rdn[3] = {target[0] - Ron[0], target[1] - Ron[1], target[2] - Ron[2]}; //Vector from point to target
+  normalize(Rdn);
+
+  double Vo[3] = {Ron[0] - target[0], Ron[1] - target[1], Ron[2] - target[2]};
+  double dist = sqrt(sqr(Vo[0]) + sqr(Vo[1]) + sqr(Vo[2]));
+
+  objectList tempList = allObject;
+  double t;
+  double Ron2[3] = {Ron[0] + Rdn[0] * EPSILON, Ron[1] + Rdn[1] * EPSILON, Ron[2] + Rdn[2] * EPSILON};
+  rayCount++;
+  while(tempList != NULL){ //For all objects
+
+    t = shoot(Ron2, Rdn, tempList);
 
-  return color;
+    if(t > 0 && t < dist){ //If distance of interserction < distance to target then shadow detected
+      dependOnObject(tempList);
+      break;
+    }
+    tempList = tempList->next;
+  }
+  dependOnSegment(Ron2, target);
+  return tempList;
+}
+
+//Pseudo random number in [0, 1[ that only depends on a point and a stratum, so renders are reproducible
+static double jitter(double* point, int stratum){
+  unsigned long long h = 0x9e3779b97f4a7c15ULL * (stratum + 1);
+  int k;
+  for(k = 0; k < 3; k++){
+    unsigned long long bits;
+    memcpy(&bits, &point[k], sizeof(bits));
+    h ^= bits + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+  }
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+  return (h >> 11) * (1.0 / 9007199254740992.0);
 }
 
-//Compute the light
-double* shade(lightList light, objectList allObject, objectList object, double* Ro, double* Rd, double bestT, int level, double ior){
-  double* color = getVector(0,0,0);
+//Jittered point of the stratum (i, j) of an n x n grid on an area light
+void areaSample(lightList light, double* Ron, int i, int j, int n, double* point){
+  double s = (i + jitter(Ron, 2 * (i * n + j))) / n;
+  double t = (j + jitter(Ron, 2 * (i * n + j) + 1)) / n;
+  int k;
+  if(light->shape == 1){ //Rectangle centered on the position
+    for(k = 0; k < 3; k++){
+      point[k] = light->position[k] + (s - 0.5) * light->edgeU[k] + (t - 0.5) * light->edgeV[k];
+    }
+  }
+  else{ //Sphere, uniform on the cap that faces the point (the whole sphere from inside)
+    double w[3] = {Ron[0] - light->position[0], Ron[1] - light->position[1], Ron[2] - light->position[2]};
+    double dist = sqrt(dotProduct(w, w));
+    double cosMax = (dist > light->radius) ? light->radius / dist : -1;
+    if(dist > 0){
+      setVector(w, w[0] / dist, w[1] / dist, w[2] / dist);
+    }
+    else{
+      setVector(w, 0, 0, 1);
+    }
+    double u[3], v[3];
+    if(fabs(w[0]) < 0.9){ //Any vector that is not parallel to w
+      setVector(u, 0, -w[2], w[1]);
+    }
+    else{
+      setVector(u, w[2], 0, -w[0]);
+    }
+    normalize(u);
+    setVector(v, w[1] * u[2] - w[2] * u[1], w[2] * u[0] - w[0] * u[2], w[0] * u[1] - w[1] * u[0]);
+
+    //Concentric map of the square on the disk, the corner strata end on the rim of the cap in 4 directions
+    double a = 2 * s - 1, b = 2 * t - 1;
+    double rho = 0, phi = 0;
+    if(fabs(a) > fabs(b)){
+      rho = a;
+      phi = M_PI / 4 * (b / a);
+    }
+    else if(b != 0){
+      rho = b;
+      phi = M_PI / 2 - M_PI / 4 * (a / b);
+    }
+    double z = 1 - rho * rho * (1 - cosMax); //Uniform on the area of the cap
+    double r = sqrt(fmax(0, 1 - z * z));
+    for(k = 0; k < 3; k++){
+      point[k] = light->position[k] + light->radius * (r * cos(phi) * u[k] + r * sin(phi) * v[k] + z * w[k]);
+    }
+  }
+}
+
+//Compute the visible part of an area light with stratified shadow rays
+//The corner strata are probed first (corners of a rectangle, rim of the cap of a sphere), the other strata are only sampled if the probes disagree (penumbra)
+double areaVisibility(objectList allObject, lightList light, double* Ron){
+  int n = (int)round(sqrt(light->samples));
+  if(n < 1) n = 1;
+  int i, j;
+  int lit = 0, samples = 0;
+  double point[3];
+
+  areaShadings++;
+  areaBudget += n * n;
+
+  if(n >= 2){
+    int probes[AREA_PROBES][2] = {{0, 0}, {n - 1, 0}, {0, n - 1}, {n - 1, n - 1}};
+    for(i = 0; i < AREA_PROBES; i++){
+      areaSample(light, Ron, probes[i][0], probes[i][1], n, point);
+      lit += (findOccluder(allObject, Ron, point) == NULL);
+    }
+    samples = AREA_PROBES;
+    if(lit == 0 || lit == AREA_PROBES){
+      areaSamples += samples;
+      return (double)lit / AREA_PROBES;
+    }
+  }
+
+  for(i = 0; i < n; i++){
+    for(j = 0; j < n; j++){
+      if(n >= 2 && (i == 0 || i == n - 1) && (j == 0 || j == n - 1)){
+        continue; //Already probed
+      }
+      areaSample(light, Ron, i, j, n, point);
+      lit += (findOccluder(allObject, Ron, point) == NULL);
+      samples++;
+    }
+  }
+  areaSamples += samples;
+  return (double)lit / (n * n);
+}
+
+//Compute the light in color
+void shade(double* color, lightList light, objectList allObject, objectList object, int primitive, double* Ro, double* Rd, double bestT, int level, double ior){
+  setVector(color, 0, 0, 0);
   if(level <= LEVEL_MAX_SHADE){
     if(object != NULL){ //If object detected
+      dependOnObject(object);
 
-      double* Ron = addVector(scaleVector(Rd, bestT), Ro); //Position of interserction point
+      double Ron[3] = {Rd[0] * bestT + Ro[0], Rd[1] * bestT + Ro[1], Rd[2] * bestT + Ro[2]}; //Position of interserction point
+      dependOnPoint(Ron);
+
+      //Compute normal vector of the object
+      double N[3];
+      getNormal(object, Ron, primitive, N);
 
 
       lightList tempLights = light;
 
       while(tempLights != NULL){ //For all lights
-        double* Rdn = subVector(tempLights->position, Ron); //Vector from point to light
+        double* position = tempLights->position;
+        double Rdn[3] = {position[0] - Ron[0], position[1] - Ron[1], position[2] - Ron[2]}; //Vector from point to light
         normalize(Rdn);
 
-        double* Vo = subVector(Ron, tempLights->position);
+        double Vo[3] = {Ron[0] - position[0], Ron[1] - position[1], Ron[2] - position[2]};
         double dist = sqrt(sqr(Vo[0]) + sqr(Vo[1]) + sqr(Vo[2]));
         normalize(Vo);
+        dependOnLight(tempLights, N, Rdn, Vo);
 
-        objectList tempList = allObject;
-        double t;
-        int shadow = 0;
-        double* Ron2 = addVector(Ron, scaleVector(Rdn, EPSILON));
-        //Shadow detection
-        while(tempList != NULL){ //For all objects
-
-
-          t = shoot(Ron2, Rdn, tempList);
-
-          if(t > 0 && t < dist){ //If distance of interserction < distance to light then shadow detected from this light
-            shadow = 1;
-            break;
+        if(tempLights->shape == 0){
+          //Shadow detection
+          if(findOccluder(allObject, Ron, tempLights->position) == NULL){
+            directShade(color, tempLights, object, N, Rdn, Rd, Vo, dist);
           }
-          tempList = tempList->next;
         }
-        if(!shadow){
-          color = directShade(color, tempLights, object, Rdn, Rd, Vo, Ron, dist);
+        else{
+          double visibility = areaVisibility(allObject, tempLights, Ron);
+          if(visibility > 0){ //Lit as a point light at the center, dimmed by the part of the light that is visible
+            double direct[3] = {0, 0, 0};
+            directShade(direct, tempLights, object, N, Rdn, Rd, Vo, dist);
+            color[0] += visibility * direct[0];
+            color[1] += visibility * direct[1];
+            color[2] += visibility * direct[2];
+          }
         }
         tempLights = tempLights->next;
       }
 
-      //Compute normal vector of the object
-      double* N;
-      if(object->kind == 1){
-        N = object->plane.normal;
-      }
-      else{
-        N = subVector(Ron, object->position);
-        normalize(N);
-      }
-
       //Compute reflected ray
-      double* reflectedRay = subVector(Rd,scaleVector(N, dotProduct(Rd,N)*2)); // Um = ur - 2(Ur.n)n
+      double RdN2 = dotProduct(Rd,N)*2;
+      double reflectedRay[3] = {Rd[0] - N[0] * RdN2, Rd[1] - N[1] * RdN2, Rd[2] - N[2] * RdN2}; // Um = ur - 2(Ur.n)n
       normalize(reflectedRay);
       double t = 0;
       double reflectedT = INFINITY;
       objectList tempList = allObject;
       objectList reflectedObject = NULL;
+      int reflectedPrimitive = -1;
 
-      double* Ron2 = addVector(Ron, scaleVector(reflectedRay, EPSILON));
+      double Ron2[3] = {Ron[0] + reflectedRay[0] * EPSILON, Ron[1] + reflectedRay[1] * EPSILON, Ron[2] + reflectedRay[2] * EPSILON};
+      rayCount++;
 
       while(tempList != NULL){ //For all objects
 
-          t = shoot(Ron2, reflectedRay, tempList);
+          int hitPrimitive = -1;
+          t = shootPrimitive(Ron2, reflectedRay, tempList, &hitPrimitive);
 
           if(t > 0 && t < reflectedT){ //If object detected
             reflectedT = t;
             reflectedObject = tempList;
+            reflectedPrimitive = hitPrimitive;
           }
         tempList = tempList->next;
       }
 
-      double* reflectedColor = shade(light, allObject, reflectedObject, Ron, reflectedRay, reflectedT, level+1, object->refractivity);
-      reflectedColor = scaleVector(reflectedColor,object->reflectivity);
+      dependOnRay(Ron2, reflectedRay, reflectedT);
+      double reflectedColor[3];
+      shade(reflectedColor, light, allObject, reflectedObject, reflectedPrimitive, Ron, reflectedRay, reflectedT, level+1, object->refractivity);
+      setVector(reflectedColor, reflectedColor[0] * object->reflectivity, reflectedColor[1] * object->reflectivity, reflectedColor[2] * object->reflectivity);
 
       //Compute refracted ray
 
-      double* refractedRay = getRefractedRay(N, ior, object->refractivity, Rd);
+      double refractedRay[3];
+      getRefractedRay(refractedRay, N, ior, object->refractivity, Rd);
       normalize(refractedRay);
 
       t = 0;
       double refractedT = INFINITY;
       tempList = allObject;
       objectList refractedObject = NULL;
+      int refractedPrimitive = -1;
 
-      Ron2 = addVector(Ron, scaleVector(refractedRay, EPSILON));
+      setVector(Ron2, Ron[0] + refractedRay[0] * EPSILON, Ron[1] + refractedRay[1] * EPSILON, Ron[2] + refractedRay[2] * EPSILON);
+      rayCount++;
 
       while(tempList != NULL){ //For all objects
 
-          t = shoot(Ron2, refractedRay, tempList);
+          int hitPrimitive = -1;
+          t = shootPrimitive(Ron2, refractedRay, tempList, &hitPrimitive);
 
           if(t > 0 && t < refractedT){ //If object detected
             refractedT = t;
             refractedObject = tempList;
+            refractedPrimitive = hitPrimitive;
           }
         tempList = tempList->next;
       }
 
-      double* refractedColor = shade(light, allObject, refractedObject, Ron, refractedRay, refractedT, level+1, object->refractivity);
-      if(refractedObject!= NULL) refractedColor = scaleVector(refractedColor,refractedObject->refractivity);
+      dependOnRay(Ron2, refractedRay, refractedT);
+      double refractedColor[3];
+      shade(refractedColor, light, allObject, refractedObject, refractedPrimitive, Ron, refractedRay, refractedT, level+1, object->refractivity);
+      if(refractedObject!= NULL){
+        double k = refractedObject->refractivity;
+        setVector(refractedColor, refractedColor[0] * k, refractedColor[1] * k, refractedColor[2] * k);
+      }
 
       //refracted light = refractivity * shade (refracted ray);
-      color = scaleVector(color, (1 - object->reflectivity - object->refractivity));
-      color = addVector(color, reflectedColor);
-      color = addVector(color, refractedColor);
+      double k = 1 - object->reflectivity - object->refractivity;
+      setVector(color, color[0] * k + reflectedColor[0] + refractedColor[0], color[1] * k + reflectedColor[1] + refractedColor[1], color[2] * k + reflectedColor[2] + refractedColor[2]);
     }
   }
-  return color;
 }
 
-int main(int argc, char *argv[]){
-  if(argc < 5){
-    fprintf(stderr, "Error: Expected ./raycaster width height input.json output.ppm");
-    exit(ERROR_RAYCAST);
+//Find a camera by name, the first one of the scene if name is NULL
+cameraList findCamera(components comp, char* name){
+  cameraList camera;
+  for(camera = comp->cameras; camera != NULL; camera = camera->next){
+    if(name == NULL || (camera->name != NULL && strcmp(camera->name, name) == 0)){
+      return camera;
+    }
   }
+  return NULL;
+}
 
-  double centerX = 0;
-  double centerY = 0;
+//Find a camera by its position in the scene file, NULL if there are fewer cameras
+cameraList cameraAt(components comp, int index){
+  cameraList camera = comp->cameras;
+  while(camera != NULL && index-- > 0){
+    camera = camera->next;
+  }
+  return (index < 0) ? camera : NULL;
+}
 
-  int width = atoi(argv[1]);
-  int height = atoi(argv[2]);
+//Compute the image plane size and the basis of a frame from a camera, frame width and height must be set
+//Return 0 or an error code
+int setupView(frames frame, cameraList camera){
+  frame->camWidth = camera->width;
+  frame->camHeight = camera->height;
+  if(camera->fov > 0){
+    frame->camWidth = 2 * tan(camera->fov / radToDeg(1) / 2);
+  }
+  if(frame->camWidth <= 0 && frame->camHeight > 0){ //Square pixels
+    frame->camWidth = frame->camHeight * frame->width / frame->height;
+  }
+  if(frame->camHeight <= 0){
+    frame->camHeight = frame->camWidth * frame->height / frame->width;
+  }
+  if(frame->camWidth <= 0 || frame->camHeight <= 0){
+    fprintf(stderr, "Error: Camera needs a width, a height or a fov\n");
+    return ERROR_RAYCAST;
+  }
 
-  double camWidth, camHeight;
+  double* forward = getVector(0, 0, 1);
+  if(camera->lookAt != NULL){
+    free(forward);
+    forward = subVector(camera->lookAt, camera->position);
+    normalize(forward);
+  }
+  double* right = crossProduct(camera->up, forward);
+  if(dotProduct(right, right) == 0 || isnan(forward[0])){
+    fprintf(stderr, "Error: Camera up vector is parallel to its view direction\n");
+    free(forward);
+    free(right);
+    return ERROR_RAYCAST;
+  }
+  normalize(right);
+  double* up = crossProduct(forward, right);
+
+  memcpy(frame->origin, camera->position, 3 * sizeof(double));
+  memcpy(frame->right, right, 3 * sizeof(double));
+  memcpy(frame->up, up, 3 * sizeof(double));
+  memcpy(frame->forward, forward, 3 * sizeof(double));
+  free(forward);
+  free(right);
+  free(up);
+  return 0;
+}
 
-  components comp = NULL;
-  comp = parseFile(argv[3], &camWidth, &camHeight);
-  objectList list = comp->objects;
-  lightList lights = comp->lights;
-  printf("%d\n", list->kind);
+//Coordinates of a point in the camera basis of a frame
+static inline void toCamera(frames frame, double* point, double* result){
+  double relative[3] = {point[0] - frame->origin[0], point[1] - frame->origin[1], point[2] - frame->origin[2]};
+  result[0] = dotProduct(relative, frame->right);
+  result[1] = dotProduct(relative, frame->up);
+  result[2] = dotProduct(relative, frame->forward);
+}
 
-  double pixWidth = camWidth / width;
-  double pixHeight = camHeight / height;
+//Check if a sphere or a mesh can be seen inside the frustum going through the rectangle [xMin, xMax] x [yMin, yMax] of the image plane
+int insideFrustum(objectList object, frames frame, double xMin, double xMax, double yMin, double yMax){
+  double planes[4][3] = {{1, 0, -xMin}, {-1, 0, xMax}, {0, 1, -yMin}, {0, -1, yMax}}; //Inward normals of the side planes
+  int i;
 
-  printf("\nScene : width = %d\theight = %d\n", width, height);
-  printf("\nCamera : width = %lf\theight = %lf\n\n", camWidth, camHeight);
-  printObjects(list);
-  printLights(lights);
-  unsigned char* data = (unsigned char*)malloc(width * height * 3 * sizeof(unsigned char));
+  if(object->kind == 0){
+    if(object->sphere.radius <= 0){
+      return 1;
+    }
+    double radius = sqrt(object->sphere.radius); //sphereIntersection takes the radius as a squared radius
+    double center[3];
+    toCamera(frame, object->position, center);
+    if(center[2] < -radius){
+      return 0;
+    }
+    for(i = 0; i < 4; i++){
+      if(dotProduct(planes[i], center) < -radius * sqrt(dotProduct(planes[i], planes[i]))){
+        return 0;
+      }
+    }
+    return 1;
+  }
+  else if(object->kind == 2){
+    meshes mesh = object->mesh.data;
+    double boxMin[3] = {INFINITY, INFINITY, INFINITY};
+    double boxMax[3] = {-INFINITY, -INFINITY, -INFINITY};
+    int k;
+    for(i = 0; i < 8; i++){ //Bounds of the box corners in the camera basis
+      double corner[3], local[3];
+      for(k = 0; k < 3; k++){
+        corner[k] = (i & (1 << k)) ? mesh->boxMax[k] : mesh->boxMin[k];
+      }
+      toCamera(frame, corner, local);
+      for(k = 0; k < 3; k++){
+        boxMin[k] = fmin(boxMin[k], local[k]);
+        boxMax[k] = fmax(boxMax[k], local[k]);
+      }
+    }
+    if(boxMax[2] < 0){
+      return 0;
+    }
+    for(i = 0; i < 4; i++){
+      double corner[3]; //Box corner the furthest inside the plane
+      for(k = 0; k < 3; k++){
+        corner[k] = (planes[i][k] >= 0) ? boxMax[k] : boxMin[k];
+      }
+      if(dotProduct(planes[i], corner) < 0){
+        return 0;
+      }
+    }
+    return 1;
+  }
+  return 1; //Planes are infinite
+}
 
-  int x,y;
+//Keep the objects that primary rays of a tile can hit, in the order of the list
+int cullObjects(objectList list, frames frame, double xMin, double xMax, double yMin, double yMax, objectList* candidates){
+  int count = 0;
+  while(list != NULL){
+    if(insideFrustum(list, frame, xMin, xMax, yMin, yMax)){
+      candidates[count++] = list;
+    }
+    list = list->next;
+  }
+  return count;
+}
+
+//Shoot the primary rays of the pixels [x0, x1[ x [y0, y1[ against the candidates of the tile
+void renderTile(objectList list, lightList lights, objectList* candidates, int count, frames frame, int x0, int y0, int x1, int y1){
+  double centerX = 0;
+  double centerY = 0;
+  int width = frame->width;
+  int height = frame->height;
+  double camWidth = frame->camWidth;
+  double camHeight = frame->camHeight;
+  double pixWidth = camWidth / width;
+  double pixHeight = camHeight / height;
+  unsigned char* data = frame->data;
+  float* heat = frame->heat;
+  int x, y, i;
+
+  //Only the pixels of the region are stored, frame rows go from bottom to top
+  x0 = (x0 > frame->regionX) ? x0 : frame->regionX;
+  x1 = (x1 < frame->regionX + frame->regionWidth) ? x1 : frame->regionX + frame->regionWidth;
+  y0 = (y0 > height - frame->regionY - frame->regionHeight) ? y0 : height - frame->regionY - frame->regionHeight;
+  y1 = (y1 < height - frame->regionY) ? y1 : height - frame->regionY;
+
+  for(y = y0; y < y1 ; y++){
+    for(x = x0; x < x1 ; x++){
+      struct timespec start, end;
+      long startRays = rayCount;
+      long startIntersections = intersectionCount;
+      if(heat != NULL){
+        clock_gettime(CLOCK_MONOTONIC, &start);
+      }
 
-  for(y = 0; y < height ; y++){
-    for(x = 0; x < width ; x++){
-      double* Ro = getVector(0, 0, 0); //Origin of camera
+      double* Ro = frame->origin; //Origin of camera
       double Rx = centerX - (camWidth/2) + pixWidth * (x+0.5);
       double Ry = centerY - (camHeight/2) + pixHeight * (y+0.5);
-      double* Rd = getVector(Rx, Ry, 1); //vector from camera to pixel
+      double Rd[3] = {Rx * frame->right[0] + Ry * frame->up[0] + frame->forward[0],
+                      Rx * frame->right[1] + Ry * frame->up[1] + frame->forward[1],
+                      Rx * frame->right[2] + Ry * frame->up[2] + frame->forward[2]}; //vector from camera to pixel
 
       normalize(Rd);
+      rayCount++;
 
       double bestT = INFINITY;
       double t = 0;
       objectList closestObject = NULL;
-      objectList tempList = list;
-
+      int closestPrimitive = -1;
 
       //Closest object detection
-      while (tempList != NULL) {
+      for(i = 0; i < count; i++){
 
-        t = shoot(Ro, Rd, tempList);
+        int hitPrimitive = -1;
+        t = shootPrimitive(Ro, Rd, candidates[i], &hitPrimitive);
 
         if(t > 0 && t < bestT){ //Select the closest object
           bestT = t;
-          closestObject = tempList;
+          closestObject = candidates[i];
+          closestPrimitive = hitPrimitive;
         }
-        tempList = tempList->next;
       }
 
-      double* color = getVector(0,0,0);
+      double color[3];
       lightList tempLights = lights;
 
       //Shading
-      color = shade(tempLights, list, closestObject, Ro, Rd, bestT, 0, 1);
+      shade(color, tempLights, list, closestObject, closestPrimitive, Ro, Rd, bestT, 0, 1);
+
+      size_t pixel = (x - frame->regionX) + (size_t)frame->regionWidth * (height - 1 - y - frame->regionY);
+      if(frame->radiance != NULL){ //Unclamped color for HDR output
+        frame->radiance[3 * pixel] = color[0];
+        frame->radiance[3 * pixel + 1] = color[1];
+        frame->radiance[3 * pixel + 2] = color[2];
+      }
+
+      data[3 * pixel] = clamp(color[0]) * 255;
+      data[3 * pixel + 1] = clamp(color[1]) * 255;
+      data[3 * pixel + 2] = clamp(color[2]) * 255;
 
-      data[ 3 * (x + width * (height - 1 - y))] = clamp(color[0]) * 255;
-      data[ 3 * (x + width * (height - 1 - y)) + 1] = clamp(color[1]) * 255;
-      data[ 3 * (x + width * (height - 1 - y)) + 2] = clamp(color[2]) * 255;
+      if(heat != NULL){ //Cost of the pixel
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        heat[3 * pixel] = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+        heat[3 * pixel + 1] = intersectionCount - startIntersections;
+        heat[3 * pixel + 2] = rayCount - startRays;
+      }
     }
   }
+}
 
-  createScene(argv[4], data, width, height); //Write the image
-  free(data);
+//Compute the pixels and the frustum (on the z = 1 plane of the camera) of a tile
+void tileBounds(frames frame, int tile, int* x0, int* y0, int* x1, int* y1, double* xMin, double* xMax, double* yMin, double* yMax){
+  double centerX = 0;
+  double centerY = 0;
+  double pixWidth = frame->camWidth / frame->width;
+  double pixHeight = frame->camHeight / frame->height;
+
+  *x0 = (tile % frame->tileColumns) * TILE_SIZE;
+  *y0 = (tile / frame->tileColumns) * TILE_SIZE;
+  *x1 = (*x0 + TILE_SIZE < frame->width) ? *x0 + TILE_SIZE : frame->width;
+  *y1 = (*y0 + TILE_SIZE < frame->height) ? *y0 + TILE_SIZE : frame->height;
+
+  *xMin = centerX - (frame->camWidth/2) + pixWidth * *x0;
+  *xMax = centerX - (frame->camWidth/2) + pixWidth * *x1;
+  *yMin = centerY - (frame->camHeight/2) + pixHeight * *y0;
+  *yMax = centerY - (frame->camHeight/2) + pixHeight * *y1;
+}
 
-  return 0;
+//Clear the dependencies of a tile before it is rendered again
+void resetDependency(dependencies dep, int objectCount, int lightCount){
+  free(dep->objects);
+  free(dep->lights);
+  dep->objects = calloc(objectCount + 1, sizeof(unsigned char));
+  dep->lights = calloc(lightCount + 1, sizeof(unsigned char));
+  dep->objectCount = objectCount;
+  dep->lightCount = lightCount;
+  int k;
+  for(k = 0; k < 3; k++){
+    dep->boxMin[k] = INFINITY;
+    dep->boxMax[k] = -INFINITY;
+    dep->pointMin[k] = INFINITY;
+    dep->pointMax[k] = -INFINITY;
+  }
+  dep->openRays = 0;
+}
+
+// Tiles of several views rendered by a pool of threads
+typedef struct renderJob{
+  components comp;
+  frames* views;
+  encoders* encoders;
+  unsigned char** dirty; // dirty tiles of each view, NULL to render all
+  int viewCount;
+  int jobCount; // tiles of the largest view * viewCount, job j is tile j / viewCount (from the top) of view j % viewCount
+  int nextJob;
+  int** rowTilesLeft; // tiles still to render in each tile row of each view
+  int objectCount;
+  int lightCount;
+  long candidateCount;
+  int tileCount;
+  long rays, intersections, shadings, samples, budget; // counters of the finished threads
+  pthread_mutex_t mutex;
+} *renderJobs;
+
+//Render thread, take the next tile of any view until there is none left
+static void* renderWorker(void* arg){
+  renderJobs jobs = (renderJobs)arg;
+  objectList* candidates = malloc((jobs->objectCount + 1) * sizeof(objectList));
+  long candidateCount = 0;
+  int tileCount = 0;
+
+  while(1){
+    pthread_mutex_lock(&jobs->mutex);
+    int job = jobs->nextJob++;
+    pthread_mutex_unlock(&jobs->mutex);
+    if(job >= jobs->jobCount){
+      break;
+    }
+    int view = job % jobs->viewCount;
+    int tile = job / jobs->viewCount;
+    frames frame = jobs->views[view];
+    unsigned char* dirty = (jobs->dirty != NULL) ? jobs->dirty[view] : NULL;
+    if(tile >= frame->tileColumns * frame->tileRows){
+      continue;
+    }
+    tile = (frame->tileRows - 1 - tile / frame->tileColumns) * frame->tileColumns + tile % frame->tileColumns; //Top of the image first, for the QOI encoder
+    if(dirty != NULL && !dirty[tile]){
+      continue;
+    }
+
+    int x0, y0, x1, y1;
+    double xMin, xMax, yMin, yMax;
+    tileBounds(frame, tile, &x0, &y0, &x1, &y1, &xMin, &xMax, &yMin, &yMax);
+
+    int count = cullObjects(jobs->comp->objects, frame, xMin, xMax, yMin, yMax, candidates);
+    candidateCount += count;
+    tileCount++;
+
+    if(frame->deps != NULL){
+      currentDependency = &frame->deps[tile];
+      resetDependency(currentDependency, jobs->objectCount, jobs->lightCount);
+    }
+    fastMath = frame->fastMath;
+    renderTile(jobs->comp->objects, jobs->comp->lights, candidates, count, frame, x0, y0, x1, y1);
+    currentDependency = NULL;
+
+    int row = tile / frame->tileColumns;
+    pthread_mutex_lock(&jobs->mutex);
+    int left = --jobs->rowTilesLeft[view][row];
+    pthread_mutex_unlock(&jobs->mutex);
+    if(left == 0){
+      encodeRows((jobs->encoders != NULL) ? jobs->encoders[view] : NULL, frame->height - y1, frame->height - y0); //Image rows are stored from top to bottom
+    }
+  }
+  free(candidates);
+
+  pthread_mutex_lock(&jobs->mutex);
+  jobs->candidateCount += candidateCount;
+  jobs->tileCount += tileCount;
+  jobs->rays += rayCount;
+  jobs->intersections += intersectionCount;
+  jobs->shadings += areaShadings;
+  jobs->samples += areaSamples;
+  jobs->budget += areaBudget;
+  pthread_mutex_unlock(&jobs->mutex);
+  return NULL;
+}
+
+//Render several views of a scene with threads threads, tiles of the views are interleaved so the threads
+//stay busy until the last view is done. Only the dirty tiles are rendered if dirty is not NULL, finished rows
+//are passed to the encoder of their view (encoders may be NULL). Return the primary candidates per tile
+double renderViews(components comp, frames* views, encoders* encoders, unsigned char** dirty, int viewCount, int threads){
+  struct renderJob jobs;
+  objectList tempList;
+  lightList tempLights;
+  int view, tile, i;
+
+  memset(&jobs, 0, sizeof(jobs));
+  jobs.comp = comp;
+  jobs.views = views;
+  jobs.encoders = encoders;
+  jobs.dirty = dirty;
+  jobs.viewCount = viewCount;
+  for(tempList = comp->objects; tempList != NULL; tempList = tempList->next){
+    jobs.objectCount++;
+  }
+  for(tempLights = comp->lights; tempLights != NULL; tempLights = tempLights->next){
+    jobs.lightCount++;
+  }
+  pthread_mutex_init(&jobs.mutex, NULL);
+
+  jobs.rowTilesLeft = malloc(viewCount * sizeof(int*));
+  for(view = 0; view < viewCount; view++){
+    frames frame = views[view];
+    int tiles = frame->tileColumns * frame->tileRows;
+    if(tiles * viewCount > jobs.jobCount){
+      jobs.jobCount = tiles * viewCount;
+    }
+    jobs.rowTilesLeft[view] = calloc(frame->tileRows, sizeof(int));
+    for(tile = 0; tile < tiles; tile++){
+      if(dirty == NULL || dirty[view] == NULL || dirty[view][tile]){
+        jobs.rowTilesLeft[view][tile / frame->tileColumns]++;
+      }
+    }
+    for(i = 0; i < frame->tileRows; i++){
+      if(jobs.rowTilesLeft[view][i] == 0){ //Nothing to render in the row
+        int y0 = i * TILE_SIZE;
+        int y1 = (y0 + TILE_SIZE < frame->height) ? y0 + TILE_SIZE : frame->height;
+        encodeRows((encoders != NULL) ? encoders[view] : NULL, frame->height - y1, frame->height - y0);
+      }
+    }
+  }
+
+  if(threads < 1){
+    threads = 1;
+  }
+  pthread_t* workers = malloc(threads * sizeof(pthread_t));
+  for(i = 0; i < threads; i++){
+    pthread_create(&workers[i], NULL, renderWorker, &jobs);
+  }
+  for(i = 0; i < threads; i++){
+    pthread_join(workers[i], NULL);
+  }
+  free(workers);
+
+  rayCount += jobs.rays;
+  intersectionCount += jobs.intersections;
+  areaShadings += jobs.shadings;
+  areaSamples += jobs.samples;
+  areaBudget += jobs.budget;
+
+  for(view = 0; view < viewCount; view++){
+    free(jobs.rowTilesLeft[view]);
+  }
+  free(jobs.rowTilesLeft);
+  pthread_mutex_destroy(&jobs.mutex);
+
+  return (jobs.tileCount > 0) ? (double)jobs.candidateCount / jobs.tileCount : 0;
+}
+
+//Render the tiles of a frame, only the dirty ones if dirty is not NULL, and pass finished rows to the encoder
+void renderTiles(components comp, frames frame, unsigned char* dirty, encoders encoder, int threads){
+  double candidates = renderViews(comp, &frame, &encoder, (dirty != NULL) ? &dirty : NULL, 1, threads);
+  printf("\nPrimary candidates per tile : %lf\n", candidates);
 }
@@ -3,16 +3,30 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include "mesh.h"
+#include "encoder.h"
 
 #define ERROR_RAYCAST 2
 #define ERROR_WRITING 3
 
+extern __thread int fastMath; //Use approximations of pow, set from the frame being rendered
+extern __thread long rayCount; //Counters of the calling thread, see raytracer.c
+extern __thread long intersectionCount;
+extern __thread long areaShadings;
+extern __thread long areaSamples;
+extern __thread long areaBudget;
+
 #define EPSILON 0.01
 #define LEVEL_MAX_SHADE 5
+#define TILE_SIZE 16
+#define AREA_SAMPLES 16
+#define AREA_PROBES 4
 
 typedef struct object{
-  int kind; // 0 = sphere, 1 = plane
+  int kind; // 0 = sphere, 1 = plane, 2 = mesh
+  int id; // position in the scene file
   double* diffuseColor;
   double* specularColor;
   double* position;
@@ -21,53 +35,139 @@ typedef struct object{
   double ior;
   union {
     struct {
-      double radius;
+      double radius; // squared radius, as written in the scene file
     } sphere;
     struct {
       double* normal;
     } plane;
+    struct {
+      meshes data;
+      char* file;
+    } mesh;
   };
   struct object* next;
 } *objectList;
 
 typedef struct light{
+  int id; // position in the scene file
+  int shape; // 0 = point or spot, 1 = rectangle, 2 = sphere
   double* color;
   double* position;
   double* direction;
   double radA0, radA1, radA2, angA0, theta;
+  double cosTheta; // cosine of theta, spotlight test without acos
+  double* edgeU; // rectangle sides, centered on position
+  double* edgeV;
+  double radius; // sphere radius, not squared unlike the radius of a sphere object
+  int samples; // shadow rays for a penumbra point, rounded to a square
   struct light* next;
 } *lightList;
 
+// Camera at position looking toward lookAt, the image plane is at distance 1 along the view direction
+typedef struct camera{
+  char* name; // NULL if not named in the scene file
+  double* position;
+  double* lookAt; // NULL to look down +Z
+  double* up;
+  double width, height; // size of the image plane
+  double fov; // horizontal field of view in degrees, replaces width if not 0
+  struct camera* next;
+} *cameraList;
+
 typedef struct component{
   objectList objects;
   lightList lights;
+  cameraList cameras; // in the order of the scene file
 } *components;
 
+// Objects and lights that influenced the pixels of a tile
+typedef struct dependency{
+  unsigned char* objects; // 1 if the object was hit or shadowed a point of the tile
+  unsigned char* lights; // 1 if the light can light a point of the tile
+  int objectCount;
+  int lightCount;
+  double boxMin[3]; // bounds of the shadow, reflected and refracted ray segments
+  double boxMax[3];
+  double pointMin[3]; // bounds of the shaded points, empty if none
+  double pointMax[3];
+  int openRays; // reflected or refracted rays that hit nothing
+} *dependencies;
+
+// Image being rendered, tiles are TILE_SIZE x TILE_SIZE pixels
+typedef struct frame{
+  int width;
+  int height;
+  double camWidth;
+  double camHeight;
+  double origin[3]; // camera position
+  double right[3]; // camera basis, the image plane is spanned by right and up at origin + forward
+  double up[3];
+  double forward[3];
+  unsigned char* data; // pixels of the region, rows from top to bottom
+  int regionX, regionY, regionWidth, regionHeight; // part of the image stored in data, heat and radiance
+  float* heat; // NULL if no heatmap
+  float* radiance; // unclamped colors, NULL if no HDR output
+  int tileColumns;
+  int tileRows;
+  dependencies deps; // one per tile, NULL if not recorded
+  int fastMath; // render with approximations of pow
+} *frames;
+
 void printObjects(objectList list);
 
 void printLights(lightList list);
 
 double shoot(double* Ro, double* Rd, objectList object);
 
-double* getRefractedRay(double* N, double ior1, double ior2, double* Rd);
+double shootPrimitive(double* Ro, double* Rd, objectList object, int* primitive);
+
+void getNormal(objectList object, double* Ron, int primitive, double* N);
+
+void getRefractedRay(double* refractedRay, double* N, double ior1, double ior2, double* Rd);
+
+objectList findOccluder(objectList allObject, double* Ron, double* target);
+
+void areaSample(lightList light, double* Ron, int i, int j, int n, double* point);
+
+double areaVisibility(objectList allObject, lightList light, double* Ron);
+
+void shade(double* color, lightList light, objectList allObject, objectList object, int primitive, double* Ro, double* Rd, double bestT, int level, double ior);
+
+void directShade(double* color, lightList light, objectList object, double* N, double* Rdn, double* Rd, double* Vo, double dist);
+
+cameraList findCamera(components comp, char* name);
 
-double* shade(lightList light, objectList allObject, objectList object, double* Ro, double* Rd, double bestT, int level, double ior);
+cameraList cameraAt(components comp, int index);
 
-double* directShade(double* color, lightList light, objectList object, double* Rdn, double* Rd, double* Vo, double* Ron, double dist);
+int setupView(frames frame, cameraList camera);
 
-void createScene(char* ppm, unsigned char* data, int width, int height);
+int insideFrustum(objectList object, frames frame, double xMin, double xMax, double yMin, double yMax);
+
+int cullObjects(objectList list, frames frame, double xMin, double xMax, double yMin, double yMax, objectList* candidates);
+
+void renderTile(objectList list, lightList lights, objectList* candidates, int count, frames frame, int x0, int y0, int x1, int y1);
+
+void tileBounds(frames frame, int tile, int* x0, int* y0, int* x1, int* y1, double* xMin, double* xMax, double* yMin, double* yMax);
+
+void resetDependency(dependencies dep, int objectCount, int lightCount);
+
+double renderViews(components comp, frames* views, encoders* encoders, unsigned char** dirty, int viewCount, int threads);
+
+void renderTiles(components comp, frames frame, unsigned char* dirty, encoders encoder, int threads);
+
+int createHeatmap(char* prefix, float* heat, int width, int height);
 
 double planeIntersection(double* Ro, double* Rd, double* position, double* normal);
 
 double sphereIntersection(double* Ro, double* Rd, double* position, double radius);
 
-double fAng(double* Vo, double* Vl, double angleMax, double a0);
+double fAng(double* Vo, double* Vl, double angleMax, double cosAngleMax, double a0);
 
 double fRad(double dist, double a0, double a1, double a2);
 
-double* diffuse(double* objDiffuse, double* lightColor, double* N, double* L);
+void diffuse(double* result, double* objDiffuse, double* lightColor, double* N, double* L);
 
-double* specular(double* objSpecular, double* lightColor, double* R, double* V,  double* N, double* L, double shininess);
+void specular(double* result, double* objSpecular, double* lightColor, double* R, double* V,  double* N, double* L, double shininess);
 
 static inline double* getVector(double x, double y, double z){
   double* v = malloc(3*sizeof(double));
@@ -77,6 +177,13 @@ static inline double* getVector(double x, double y, double z){
   return v;
 }
 
+//Stack vector for the render path, the arguments can read result
+static inline void setVector(double* result, double x, double y, double z){
+  result[0] = x;
+  result[1] = y;
+  result[2] = z;
+}
+
 static inline double* subVector(double* a, double* b){
   return getVector(a[0] - b[0], a[1] - b[1], a[2] - b[2]);
 }
@@ -97,6 +204,10 @@ static inline double dotProduct(double* a, double* b){
   return (a[0]*b[0] + a[1]*b[1] + a[2]*b[2]);
 }
 
+static inline double* crossProduct(double* a, double* b){
+  return getVector(a[1]*b[2] - a[2]*b[1], a[2]*b[0] - a[0]*b[2], a[0]*b[1] - a[1]*b[0]);
+}
+
 static inline double sqr(double v) {
   return v*v;
 }
@@ -105,6 +216,23 @@ static inline double norm(double* a){
   return sqrt((a[0] * a[0]) + (a[1] * a[1]) * (a[2] * a[2]));
 }
 
+//Faster pow(x, y) for the exponents used by the shading
+//Integer exponents are computed by squaring (shininess, x^0 is 1 like pow), 0.5 with sqrt (angular attenuation)
+static inline double fastPow(double x, double y) {
+  if(y == (int)y && y >= 0 && y <= 64){
+    int n = (int)y;
+    double result = 1;
+    while(n > 0){
+      if(n & 1) result *= x;
+      x *= x;
+      n >>= 1;
+    }
+    return result;
+  }
+  if(y == 0.5) return sqrt(x);
+  return pow(x, y);
+}
+
 static inline void normalize(double* v) {
   double len = sqrt(sqr(v[0]) + sqr(v[1]) + sqr(v[2]));
   v[0] /= len;
@@ -0,0 +1,182 @@
+#include <time.h>
+#include <unistd.h>
+#include "raytracer.h"
+#include "encoder.h"
+
+#define OPERATOR_CLAMP 0
+#define OPERATOR_REINHARD 1
+#define OPERATOR_ACES 2
+
+#define GAMMA_TABLE 65536
+
+typedef float v4f __attribute__((vector_size(4*sizeof(float))));
+typedef int v4i __attribute__((vector_size(4*sizeof(int))));
+
+//Load a 3 channel PFM file, rows are returned from top to bottom
+float* readPfm(char* filename, int* width, int* height){
+  FILE* file = fopen(filename, "rb");
+  char type[3];
+  float scale;
+
+  if (file == NULL) {
+    fprintf(stderr, "Error: Could not open file \"%s\"\n", filename);
+    exit(ERROR_RAYCAST);
+  }
+  if(fscanf(file, "%2s %d %d %f", type, width, height, &scale) != 4 || strcmp(type, "PF") != 0 || *width <= 0 || *height <= 0){
+    fprintf(stderr, "Error: \"%s\" is not a color PFM file\n", filename);
+    exit(ERROR_RAYCAST);
+  }
+  fgetc(file);
+
+  size_t row = 3 * (size_t)*width;
+  float* data = malloc(row * *height * sizeof(float));
+  int y;
+  for(y = *height - 1; y >= 0; y--){ //PFM rows go from bottom to top
+    if(fread(data + row * y, sizeof(float), row, file) != row){
+      fprintf(stderr, "Error: Could not read data in file \"%s\"\n", filename);
+      exit(ERROR_RAYCAST);
+    }
+  }
+  fclose(file);
+
+  if(scale > 0){ //Big endian file
+    size_t i;
+    unsigned char* bytes = (unsigned char*)data;
+    for(i = 0; i < row * *height * sizeof(float); i += 4){
+      unsigned char swap = bytes[i];
+      bytes[i] = bytes[i + 3];
+      bytes[i + 3] = swap;
+      swap = bytes[i + 1];
+      bytes[i + 1] = bytes[i + 2];
+      bytes[i + 2] = swap;
+    }
+  }
+  return data;
+}
+
+//Pick a where mask is set, b elsewhere
+static inline v4f select4(v4i mask, v4f a, v4f b){
+  return (v4f)((mask & (v4i)a) | (~mask & (v4i)b));
+}
+
+//Apply exposure and a tone curve to 4 values at once, results are in [0, 1]
+static inline v4f toneCurve(v4f x, float exposure, int operator){
+  v4f zero = {0, 0, 0, 0};
+  v4f one = {1, 1, 1, 1};
+
+  x *= exposure;
+  x = select4(x > zero, x, zero);
+  if(operator == OPERATOR_REINHARD){
+    x = x / (one + x);
+  }
+  else if(operator == OPERATOR_ACES){ //Narkowicz fit of the ACES filmic curve
+    x = (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+  }
+  return select4(x < one, x, one);
+}
+
+//Convert the float image to 8 bits, 4 channels at a time
+void toneMap(float* hdr, unsigned char* data, size_t size, float exposure, float gamma, int operator){
+  unsigned char* table = NULL;
+  size_t i;
+  int k;
+
+  if(gamma != 1){
+    table = malloc(GAMMA_TABLE);
+    for(i = 0; i < GAMMA_TABLE; i++){
+      table[i] = pow((double)i / (GAMMA_TABLE - 1), 1 / gamma) * 255 + 0.5;
+    }
+  }
+
+  for(i = 0; i < size; i += 4){
+    v4f x;
+    if(i + 4 <= size){
+      memcpy(&x, hdr + i, sizeof(v4f));
+    }
+    else{ //Last values
+      float last[4] = {0, 0, 0, 0};
+      memcpy(last, hdr + i, (size - i) * sizeof(float));
+      memcpy(&x, last, sizeof(v4f));
+    }
+    x = toneCurve(x, exposure, operator);
+
+    v4i value;
+    if(table == NULL){
+      value = __builtin_convertvector(x * 255, v4i); //Truncated like the raytracer output
+    }
+    else{
+      value = __builtin_convertvector(x * (GAMMA_TABLE - 1) + 0.5f, v4i);
+    }
+    for(k = 0; k < 4 && i + k < size; k++){
+      data[i + k] = (table == NULL) ? value[k] : table[value[k]];
+    }
+  }
+  free(table);
+}
+
+int main(int argc, char *argv[]){
+  if(argc < 3){
+    fprintf(stderr, "Error: Expected ./tonemap input.pfm output.(ppm|qoi|png) [--exposure stops] [--gamma value] [--operator clamp|reinhard|aces]\n");
+    exit(ERROR_RAYCAST);
+  }
+
+  float exposure = 0;
+  float gamma = 1;
+  int operator = OPERATOR_CLAMP;
+  int i;
+  for(i = 3; i < argc; i++){
+    if(strcmp(argv[i], "--exposure") == 0 && i + 1 < argc){
+      exposure = atof(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--gamma") == 0 && i + 1 < argc){
+      gamma = atof(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--operator") == 0 && i + 1 < argc){
+      i++;
+      if(strcmp(argv[i], "clamp") == 0){
+        operator = OPERATOR_CLAMP;
+      }
+      else if(strcmp(argv[i], "reinhard") == 0){
+        operator = OPERATOR_REINHARD;
+      }
+      else if(strcmp(argv[i], "aces") == 0){
+        operator = OPERATOR_ACES;
+      }
+      else{
+        fprintf(stderr, "Error: Unknown operator \"%s\"\n", argv[i]);
+        exit(ERROR_RAYCAST);
+      }
+    }
+    else{
+      fprintf(stderr, "Error: Unknown option \"%s\"\n", argv[i]);
+      exit(ERROR_RAYCAST);
+    }
+  }
+  if(gamma <= 0){
+    fprintf(stderr, "Error: Gamma must be positive\n");
+    exit(ERROR_RAYCAST);
+  }
+
+  int width, height;
+  float* hdr = readPfm(argv[1], &width, &height);
+  unsigned char* data = malloc(3 * (size_t)width * height);
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  toneMap(hdr, data, 3 * (size_t)width * height, pow(2, exposure), gamma, operator);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  printf("Tone mapped %d x %d pixels in %lf ms\n", width, height, (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+
+  encoders encoder = startEncoder(argv[2], data, width, height, TILE_SIZE, sysconf(_SC_NPROCESSORS_ONLN));
+  if(encoder == NULL){
+    exit(ERROR_WRITING);
+  }
+  encodeRows(encoder, 0, height);
+  if(finishEncoder(encoder) != 0){
+    exit(ERROR_WRITING);
+  }
+
+  free(hdr);
+  free(data);
+  return 0;
+}
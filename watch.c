@@ -0,0 +1,388 @@
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+#include "json_parser.h"
+#include "encoder.h"
+#include "watch.h"
+
+int vectorEqual(double* a, double* b){
+  return a[0] == b[0] && a[1] == b[1] && a[2] == b[2];
+}
+
+//Compare the triangles of two loaded meshes, the file may have changed under the same name
+int meshEqual(meshes a, meshes b){
+  return a->vertexCount == b->vertexCount && a->triangleCount == b->triangleCount
+    && memcmp(a->vertices, b->vertices, 3 * (size_t)a->vertexCount * sizeof(double)) == 0
+    && memcmp(a->indices, b->indices, 3 * (size_t)a->triangleCount * sizeof(int)) == 0;
+}
+
+//Check if two objects cover the same space
+int objectGeometryEqual(objectList a, objectList b){
+  if(a->kind != b->kind || !vectorEqual(a->position, b->position)){
+    return 0;
+  }
+  switch (a->kind) {
+    case 0:
+    return a->sphere.radius == b->sphere.radius;
+    case 1:
+    return vectorEqual(a->plane.normal, b->plane.normal);
+    default:
+    return meshEqual(a->mesh.data, b->mesh.data);
+  }
+}
+
+int objectEqual(objectList a, objectList b){
+  return objectGeometryEqual(a, b) && vectorEqual(a->diffuseColor, b->diffuseColor) && vectorEqual(a->specularColor, b->specularColor)
+    && a->reflectivity == b->reflectivity && a->refractivity == b->refractivity && a->ior == b->ior;
+}
+
+int lightEqual(lightList a, lightList b){
+  return vectorEqual(a->color, b->color) && vectorEqual(a->position, b->position) && vectorEqual(a->direction, b->direction)
+    && a->radA0 == b->radA0 && a->radA1 == b->radA1 && a->radA2 == b->radA2 && a->angA0 == b->angA0 && a->theta == b->theta
+    && a->shape == b->shape && vectorEqual(a->edgeU, b->edgeU) && vectorEqual(a->edgeV, b->edgeV) && a->radius == b->radius && a->samples == b->samples;
+}
+
+//Compute the bounding box of an object, infinite for planes
+void objectBounds(objectList object, double* boxMin, double* boxMax){
+  int k;
+  for(k = 0; k < 3; k++){
+    if(object->kind == 0 && object->sphere.radius > 0){
+      double radius = sqrt(object->sphere.radius); //sphereIntersection takes the radius as a squared radius
+      boxMin[k] = object->position[k] - radius;
+      boxMax[k] = object->position[k] + radius;
+    }
+    else if(object->kind == 2){
+      boxMin[k] = object->mesh.data->boxMin[k];
+      boxMax[k] = object->mesh.data->boxMax[k];
+    }
+    else{
+      boxMin[k] = -INFINITY;
+      boxMax[k] = INFINITY;
+    }
+  }
+}
+
+static int boxOverlap(double* minA, double* maxA, double* minB, double* maxB){
+  int k;
+  for(k = 0; k < 3; k++){
+    if(minA[k] > maxB[k] || minB[k] > maxA[k]){
+      return 0;
+    }
+  }
+  return 1;
+}
+
+//Check if a light can light points of the box, only spotlights are limited (by their cone)
+static int lightReaches(lightList light, double* boxMin, double* boxMax){
+  double center[3], toCenter[3];
+  double radius = 0;
+  int k;
+  if(light->theta == 0 || fabs(dotProduct(light->direction, light->direction) - 1) > 1e-9){
+    return 1;
+  }
+  for(k = 0; k < 3; k++){
+    center[k] = (boxMin[k] + boxMax[k]) / 2;
+    toCenter[k] = center[k] - light->position[k];
+    radius += sqr(boxMax[k] - center[k]);
+  }
+  radius = sqrt(radius);
+  double dist = sqrt(dotProduct(toCenter, toCenter));
+  if(dist <= radius){
+    return 1;
+  }
+  double angle = radToDeg(acos(fmax(-1, fmin(1, dotProduct(toCenter, light->direction) / dist))));
+  return angle - radToDeg(asin(radius / dist)) <= light->theta;
+}
+
+//Pair the objects of two versions of a scene, match receives the new id of each previous object (-1 if none)
+//Equal objects are paired first, then the objects that only changed their material (changed is set for those)
+static void matchObjects(objectList previous, objectList next, int* match, unsigned char* changed, unsigned char* taken){
+  objectList a, b;
+  int i, j, pass;
+  for(pass = 0; pass < 2; pass++){
+    for(a = previous, i = 0; a != NULL; a = a->next, i++){
+      if(pass == 0){
+        match[i] = -1;
+      }
+      for(b = next, j = 0; b != NULL && match[i] < 0; b = b->next, j++){
+        if(!taken[j] && (pass == 0 ? objectEqual(a, b) : objectGeometryEqual(a, b))){
+          match[i] = j;
+          taken[j] = 1;
+          changed[i] = (pass == 1);
+        }
+      }
+    }
+  }
+}
+
+//Compare two versions of a scene and mark the tiles whose dependencies touch a changed object or light
+//Objects and lights are matched by content, so inserting or removing one does not change the others
+//A tile is dirty if it depended on the previous version of a changed entity, if a new or changed light
+//can reach its shaded points, or if the new geometry enters its frustum, the bounds of its secondary
+//rays or the path of a secondary ray that hit nothing
+unsigned char* dirtyTiles(components previous, components next, frames frame, int cameraChanged){
+  int tileCount = frame->tileColumns * frame->tileRows;
+  unsigned char* dirty = calloc(tileCount, sizeof(unsigned char));
+  int oldObjects = 0, newObjects = 0, oldLights = 0, newLights = 0;
+  objectList a, b;
+  lightList la, lb;
+  int i, j, tile;
+
+  for(a = previous->objects; a != NULL; a = a->next) oldObjects++;
+  for(b = next->objects; b != NULL; b = b->next) newObjects++;
+  for(la = previous->lights; la != NULL; la = la->next) oldLights++;
+  for(lb = next->lights; lb != NULL; lb = lb->next) newLights++;
+
+  int* objectMatch = malloc((oldObjects + 1) * sizeof(int));
+  unsigned char* changedObjects = calloc(oldObjects + 1, sizeof(unsigned char)); //Previous objects changed or removed
+  unsigned char* takenObjects = calloc(newObjects + 1, sizeof(unsigned char));
+  objectList* newGeometry = calloc(newObjects + 1, sizeof(objectList)); //New objects moved, reshaped or added
+  int* lightMatch = malloc((oldLights + 1) * sizeof(int));
+  unsigned char* takenLights = calloc(newLights + 1, sizeof(unsigned char));
+  lightList* newLightList = calloc(newLights + 1, sizeof(lightList)); //New lights changed or added
+  int geometryCount = 0, lightCount = 0;
+
+  matchObjects(previous->objects, next->objects, objectMatch, changedObjects, takenObjects);
+  for(i = 0; i < oldObjects; i++){
+    changedObjects[i] |= (objectMatch[i] < 0);
+  }
+  for(b = next->objects, j = 0; b != NULL; b = b->next, j++){
+    if(!takenObjects[j]){
+      newGeometry[geometryCount++] = b;
+    }
+  }
+
+  for(la = previous->lights, i = 0; la != NULL; la = la->next, i++){
+    lightMatch[i] = -1;
+    for(lb = next->lights, j = 0; lb != NULL && lightMatch[i] < 0; lb = lb->next, j++){
+      if(!takenLights[j] && lightEqual(la, lb)){
+        lightMatch[i] = j;
+        takenLights[j] = 1;
+      }
+    }
+  }
+  for(lb = next->lights, j = 0; lb != NULL; lb = lb->next, j++){
+    if(!takenLights[j]){
+      newLightList[lightCount++] = lb;
+    }
+  }
+
+  for(tile = 0; tile < tileCount; tile++){
+    dependencies dep = &frame->deps[tile];
+    if(cameraChanged || dep->objects == NULL){
+      dirty[tile] = 1;
+      continue;
+    }
+    for(i = 0; i < dep->objectCount && i < oldObjects && !dirty[tile]; i++){
+      dirty[tile] = changedObjects[i] && dep->objects[i];
+    }
+    for(i = 0; i < dep->lightCount && i < oldLights && !dirty[tile]; i++){
+      dirty[tile] = (lightMatch[i] < 0) && dep->lights[i];
+    }
+    for(i = 0; i < lightCount && !dirty[tile] && dep->pointMin[0] <= dep->pointMax[0]; i++){
+      dirty[tile] = lightReaches(newLightList[i], dep->pointMin, dep->pointMax);
+    }
+    for(i = 0; i < geometryCount && !dirty[tile]; i++){
+      int x0, y0, x1, y1;
+      double xMin, xMax, yMin, yMax, boxMin[3], boxMax[3];
+      tileBounds(frame, tile, &x0, &y0, &x1, &y1, &xMin, &xMax, &yMin, &yMax);
+      objectBounds(newGeometry[i], boxMin, boxMax);
+      dirty[tile] = dep->openRays || insideFrustum(newGeometry[i], frame, xMin, xMax, yMin, yMax) || boxOverlap(boxMin, boxMax, dep->boxMin, dep->boxMax);
+    }
+
+    //Clean tiles keep their dependencies, with the numbering of the new scene
+    if(!dirty[tile]){
+      unsigned char* objects = calloc(newObjects + 1, sizeof(unsigned char));
+      unsigned char* lights = calloc(newLights + 1, sizeof(unsigned char));
+      for(i = 0; i < dep->objectCount && i < oldObjects; i++){
+        if(objectMatch[i] >= 0){
+          objects[objectMatch[i]] = dep->objects[i];
+        }
+      }
+      for(i = 0; i < dep->lightCount && i < oldLights; i++){
+        if(lightMatch[i] >= 0){
+          lights[lightMatch[i]] = dep->lights[i];
+        }
+      }
+      free(dep->objects);
+      free(dep->lights);
+      dep->objects = objects;
+      dep->lights = lights;
+      dep->objectCount = newObjects;
+      dep->lightCount = newLights;
+    }
+  }
+
+  free(objectMatch);
+  free(changedObjects);
+  free(takenObjects);
+  free(newGeometry);
+  free(lightMatch);
+  free(takenLights);
+  free(newLightList);
+  return dirty;
+}
+
+//Add a watch on the directory of path, name receives the file name matched by the events
+static int watchFile(int fd, char* path, char** name, int* watch){
+  char* slash = strrchr(path, '/');
+  char* directory = relativePath(path, ".");
+  *watch = inotify_add_watch(fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO); //Directories so editors that replace the file are seen too
+  if(*watch < 0){
+    perror(directory);
+    free(directory);
+    return ERROR_RAYCAST;
+  }
+  *name = strdup((slash != NULL) ? slash + 1 : path);
+  free(directory);
+  return 0;
+}
+
+//Watch the scene file and the mesh files it loads, names and watches receive one entry per file
+//The directories already watched stay watched, their other files are ignored
+static int watchFiles(int fd, char* filename, components comp, char*** names, int** watches, int* count){
+  objectList object;
+  int i;
+  for(i = 0; i < *count; i++){
+    free((*names)[i]);
+  }
+  *count = 0;
+  for(object = comp->objects; object != NULL; object = object->next){
+    (*count) += (object->kind == 2);
+  }
+  *names = realloc(*names, (*count + 1) * sizeof(char*));
+  *watches = realloc(*watches, (*count + 1) * sizeof(int));
+  *count = 0;
+
+  if(watchFile(fd, filename, &(*names)[0], &(*watches)[0]) != 0){
+    return ERROR_RAYCAST;
+  }
+  *count = 1;
+  for(object = comp->objects; object != NULL; object = object->next){
+    if(object->kind == 2){
+      char* path = relativePath(filename, object->mesh.file);
+      int error = watchFile(fd, path, &(*names)[*count], &(*watches)[*count]);
+      free(path);
+      if(error){
+        return error;
+      }
+      (*count)++;
+    }
+  }
+  return 0;
+}
+
+static void freeWatches(int fd, char** names, int* watches, int count){
+  int i;
+  for(i = 0; i < count; i++){
+    free(names[i]);
+  }
+  free(names);
+  free(watches);
+  close(fd);
+}
+
+//Wait for the scene file or one of its mesh files to be written again and re-render the tiles touched by the changes
+//The view is the camera called view, or the camera viewIndex if it has no name, comp is replaced by each new version
+//Only returns on error, with ERROR_RAYCAST
+int watchScene(char* filename, char* output, char* heatmap, char* hdr, char* view, int viewIndex, components* comp, frames frame, int threads){
+  int fd = inotify_init();
+  if(fd < 0){
+    perror("inotify_init");
+    return ERROR_RAYCAST;
+  }
+
+  char** names = NULL;
+  int* watches = NULL;
+  int watchCount = 0;
+  if(watchFiles(fd, filename, *comp, &names, &watches, &watchCount) != 0){
+    freeWatches(fd, names, watches, watchCount);
+    return ERROR_RAYCAST;
+  }
+
+  char buffer[WATCH_BUFFER] __attribute__((aligned(__alignof__(struct inotify_event))));
+  int tileCount = frame->tileColumns * frame->tileRows;
+
+  while(1){
+    printf("\nWatching \"%s\" for changes\n", filename);
+    fflush(stdout);
+
+    int changed = 0;
+    while(!changed){
+      ssize_t length = read(fd, buffer, sizeof(buffer));
+      if(length <= 0){
+        perror("read");
+        freeWatches(fd, names, watches, watchCount);
+        return ERROR_RAYCAST;
+      }
+      char* p;
+      for(p = buffer; p < buffer + length; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len){
+        struct inotify_event* event = (struct inotify_event*)p;
+        int i;
+        for(i = 0; i < watchCount && event->len > 0; i++){
+          changed |= (event->wd == watches[i] && strcmp(event->name, names[i]) == 0);
+        }
+      }
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    //Errors keep the previous image, the scene is read again on the next save
+    components next = NULL;
+    if(parseFile(filename, &next) != 0){
+      continue;
+    }
+    if(watchFiles(fd, filename, next, &names, &watches, &watchCount) != 0){ //The mesh files may have changed
+      freeComponents(next);
+      freeWatches(fd, names, watches, watchCount);
+      return ERROR_RAYCAST;
+    }
+    cameraList camera = (view != NULL) ? findCamera(next, view) : cameraAt(next, viewIndex);
+    struct frame viewFrame = *frame;
+    if(camera == NULL){
+      if(view != NULL){
+        fprintf(stderr, "Error: No camera named \"%s\"\n", view);
+      }
+      else{
+        fprintf(stderr, "Error: No camera %d in the scene\n", viewIndex);
+      }
+      freeComponents(next);
+      continue;
+    }
+    if(setupView(&viewFrame, camera) != 0){
+      freeComponents(next);
+      continue;
+    }
+    int cameraChanged = (viewFrame.camWidth != frame->camWidth || viewFrame.camHeight != frame->camHeight || !vectorEqual(viewFrame.origin, frame->origin)
+                         || !vectorEqual(viewFrame.right, frame->right) || !vectorEqual(viewFrame.up, frame->up) || !vectorEqual(viewFrame.forward, frame->forward));
+    *frame = viewFrame;
+
+    unsigned char* dirty = dirtyTiles(*comp, next, frame, cameraChanged);
+    freeComponents(*comp);
+    *comp = next;
+
+    int dirtyCount = 0;
+    int tile;
+    for(tile = 0; tile < tileCount; tile++){
+      dirtyCount += dirty[tile];
+    }
+
+    //Write errors keep watching, the image is written again on the next save
+    encoders encoder = startEncoder(output, frame->data, frame->width, frame->height, TILE_SIZE, threads);
+    renderTiles(*comp, frame, dirty, encoder, threads);
+    if(encoder != NULL){
+      finishEncoder(encoder);
+    }
+    if(heatmap != NULL){
+      createHeatmap(heatmap, frame->heat, frame->width, frame->height);
+    }
+    if(hdr != NULL){
+      createPfm(hdr, frame->radiance, frame->width, frame->height);
+    }
+    free(dirty);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("\nRe-rendered %d of %d tiles in %lf ms\n", dirtyCount, tileCount, (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+  }
+}
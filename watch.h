@@ -0,0 +1,27 @@
+#ifndef __WATCH
+#define __WATCH
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "raytracer.h"
+
+#define WATCH_BUFFER 4096
+
+int vectorEqual(double* a, double* b);
+
+int meshEqual(meshes a, meshes b);
+
+int objectGeometryEqual(objectList a, objectList b);
+
+int objectEqual(objectList a, objectList b);
+
+int lightEqual(lightList a, lightList b);
+
+void objectBounds(objectList object, double* boxMin, double* boxMax);
+
+unsigned char* dirtyTiles(components previous, components next, frames frame, int cameraChanged);
+
+int watchScene(char* filename, char* output, char* heatmap, char* hdr, char* view, int viewIndex, components* comp, frames frame, int threads);
+
+#endif